@@ -0,0 +1,391 @@
+#include "Capture.h"
+#include "ChannelManager.h"
+#include "ClockSync.h"
+#include "Logger.h"
+
+namespace remote {
+
+static constexpr uint32_t CAPTURE_MAGIC = 0x4352514d; // "MQRC"
+static constexpr uint32_t CAPTURE_VERSION = 1;
+static constexpr size_t CAPTURE_HEADER_SIZE = sizeof(uint32_t) * 2;
+
+// size, time, direction, id, channel length, peer length
+static constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(int64_t) + 2 + sizeof(uint16_t) * 2;
+
+// clients on one machine capturing at the same time, each needs a slot of its own
+static constexpr int MAX_CAPTURE_SLOTS = 64;
+
+// keeps a replay at full speed from stalling a frame
+static constexpr int MAX_REPLAY_PER_PULSE = 1000;
+
+template <typename T>
+static uint8_t* Write(uint8_t* out, T value)
+{
+	memcpy(out, &value, sizeof(T));
+	return out + sizeof(T);
+}
+
+template <typename T>
+static T Read(const uint8_t* in)
+{
+	T value;
+	memcpy(&value, in, sizeof(T));
+	return value;
+}
+
+bool MappedFile::Create(const std::string& path, size_t size)
+{
+	Close();
+
+	m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// mapping grows the file to its full size, Close trims it back to what was written
+	LARGE_INTEGER mapSize;
+	mapSize.QuadPart = size;
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(mapSize.HighPart), mapSize.LowPart, nullptr);
+	if (m_mapping)
+	{
+		m_view = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, size));
+	}
+
+	m_writable = true;
+	if (!m_view)
+	{
+		Close();
+		return false;
+	}
+
+	m_size = size;
+	return true;
+}
+
+bool MappedFile::OpenRead(const std::string& path)
+{
+	Close();
+
+	// the file may still be written by a running capture
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(m_file, &fileSize) && fileSize.QuadPart > 0)
+	{
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping)
+		{
+			m_view = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+		}
+	}
+
+	if (!m_view)
+	{
+		Close();
+		return false;
+	}
+
+	m_size = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::Close(size_t length)
+{
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+		m_view = nullptr;
+	}
+
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		if (m_writable)
+		{
+			LARGE_INTEGER end;
+			end.QuadPart = length;
+			SetFilePointerEx(m_file, end, nullptr, FILE_BEGIN);
+			SetEndOfFile(m_file);
+		}
+
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+
+	m_size = 0;
+	m_writable = false;
+}
+
+TrafficCapture::~TrafficCapture()
+{
+	Stop();
+
+	if (m_slotMutex)
+	{
+		CloseHandle(m_slotMutex);
+	}
+}
+
+bool TrafficCapture::ClaimSlot()
+{
+	for (int slot = 0; slot < MAX_CAPTURE_SLOTS; ++slot)
+	{
+		// whoever creates the mutex first owns the slot, it goes away with the last handle to it
+		HANDLE mutex = CreateMutexA(nullptr, FALSE, fmt::format("Local\\MQRemoteCapture-{}", slot).c_str());
+		if (!mutex)
+			continue;
+
+		if (GetLastError() != ERROR_ALREADY_EXISTS)
+		{
+			m_slotMutex = mutex;
+			m_slot = slot;
+			return true;
+		}
+
+		CloseHandle(mutex);
+	}
+
+	return false;
+}
+
+bool TrafficCapture::Start(std::string_view directory, size_t maxFileSize, int maxFiles)
+{
+	Stop();
+
+	if (!m_slotMutex && !ClaimSlot())
+	{
+		WriteChatf(PLUGIN_MSG "\arEvery capture slot is taken by another client, capture stopped.");
+		return false;
+	}
+
+	m_path = fmt::format("{}/MQRemote_{}.rcap", directory, m_slot);
+	m_maxFileSize = std::max(maxFileSize, CAPTURE_HEADER_SIZE + RECORD_HEADER_SIZE);
+	m_maxFiles = std::max(maxFiles, 1);
+
+	// an earlier capture at the same path is kept as the newest rotated file
+	ShiftFiles();
+	return Rotate();
+}
+
+void TrafficCapture::Stop()
+{
+	if (m_file.IsOpen())
+	{
+		m_file.Close(m_used);
+	}
+}
+
+void TrafficCapture::ShiftFiles()
+{
+	for (int i = m_maxFiles - 1; i > 0; --i)
+	{
+		std::string from = i == 1 ? m_path : fmt::format("{}.{}", m_path, i - 1);
+		std::string to = fmt::format("{}.{}", m_path, i);
+		MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING);
+	}
+}
+
+bool TrafficCapture::Rotate()
+{
+	if (m_file.IsOpen())
+	{
+		m_file.Close(m_used);
+		ShiftFiles();
+		++m_rotations;
+	}
+
+	if (!m_file.Create(m_path, m_maxFileSize))
+	{
+		WriteChatf(PLUGIN_MSG "\arCould not create capture file \ay%s\ax, capture stopped.", m_path.c_str());
+		return false;
+	}
+
+	uint8_t* out = m_file.GetData();
+	out = Write(out, CAPTURE_MAGIC);
+	Write(out, CAPTURE_VERSION);
+	m_used = CAPTURE_HEADER_SIZE;
+
+	return true;
+}
+
+uint8_t* TrafficCapture::BeginRecord(CaptureDirection direction, std::string_view channel, std::string_view peer,
+	proto::remote::MessageId id, size_t payloadSize)
+{
+	channel = channel.substr(0, UINT16_MAX);
+	peer = peer.substr(0, UINT16_MAX);
+
+	const size_t size = RECORD_HEADER_SIZE + channel.size() + peer.size() + payloadSize;
+	if (size > m_maxFileSize - CAPTURE_HEADER_SIZE)
+	{
+		++m_dropped;
+		return nullptr;
+	}
+
+	if (m_used + size > m_file.GetSize() && !Rotate())
+		return nullptr;
+
+	// the size is written last by EndRecord, a record cut short by a crash reads as the end of the file
+	uint8_t* out = m_file.GetData() + m_used + sizeof(uint32_t);
+	out = Write(out, WallClockMicros());
+	out = Write(out, static_cast<uint8_t>(direction));
+	out = Write(out, static_cast<uint8_t>(id));
+	out = Write(out, static_cast<uint16_t>(channel.size()));
+	out = Write(out, static_cast<uint16_t>(peer.size()));
+	memcpy(out, channel.data(), channel.size());
+	out += channel.size();
+	memcpy(out, peer.data(), peer.size());
+	out += peer.size();
+
+	return out;
+}
+
+void TrafficCapture::EndRecord(const uint8_t* end)
+{
+	uint8_t* record = m_file.GetData() + m_used;
+	const size_t size = end - record;
+	Write(record, static_cast<uint32_t>(size));
+
+	m_used += size;
+	m_bytes += size;
+	++m_records;
+}
+
+void TrafficCapture::Record(CaptureDirection direction, std::string_view channel, std::string_view peer,
+	proto::remote::MessageId id, const std::string& payload)
+{
+	if (!IsActive())
+		return;
+
+	if (uint8_t* out = BeginRecord(direction, channel, peer, id, payload.size()))
+	{
+		memcpy(out, payload.data(), payload.size());
+		EndRecord(out + payload.size());
+	}
+}
+
+void TrafficCapture::Record(CaptureDirection direction, std::string_view channel, std::string_view peer,
+	const proto::remote::Message& message)
+{
+	if (!IsActive())
+		return;
+
+	const size_t size = message.ByteSizeLong();
+	if (uint8_t* out = BeginRecord(direction, channel, peer, message.id(), size))
+	{
+		EndRecord(message.SerializeWithCachedSizesToArray(out));
+	}
+}
+
+// Captures from another group or zone still replay into ours, so channels are matched by name
+static Channel* FindReplayChannel(ChannelManager& channels, std::string_view dnsName)
+{
+	const size_t dot = dnsName.find('.');
+	std::string_view name = dnsName.substr(0, dot);
+	if (name == "custom" && dot != std::string_view::npos)
+	{
+		name = dnsName.substr(dot + 1);
+	}
+
+	return channels.FindChannel(name);
+}
+
+bool TrafficReplay::Start(const std::string& path, double speed, bool run)
+{
+	Stop();
+
+	if (!m_file.OpenRead(path))
+	{
+		WriteChatf(PLUGIN_MSG "\arCould not open capture file \ay%s\ax.", path.c_str());
+		return false;
+	}
+
+	const uint8_t* data = m_file.GetData();
+	if (m_file.GetSize() < CAPTURE_HEADER_SIZE || Read<uint32_t>(data) != CAPTURE_MAGIC
+		|| Read<uint32_t>(data + sizeof(uint32_t)) != CAPTURE_VERSION)
+	{
+		WriteChatf(PLUGIN_MSG "\ay%s\ax is not a capture file.", path.c_str());
+		Stop();
+		return false;
+	}
+
+	m_pos = CAPTURE_HEADER_SIZE;
+	m_firstTime = m_file.GetSize() >= m_pos + RECORD_HEADER_SIZE ? Read<int64_t>(data + m_pos + sizeof(uint32_t)) : 0;
+	m_startedAt = std::chrono::steady_clock::now();
+	m_speed = std::max(speed, 0.0);
+	m_run = run;
+	m_delivered = 0;
+	m_skipped = 0;
+
+	return true;
+}
+
+void TrafficReplay::Stop()
+{
+	m_file.Close();
+}
+
+void TrafficReplay::OnPulse(ChannelManager& channels)
+{
+	if (!IsActive())
+		return;
+
+	const int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - m_startedAt).count();
+	const uint8_t* data = m_file.GetData();
+	const size_t fileSize = m_file.GetSize();
+
+	for (int count = 0; count < MAX_REPLAY_PER_PULSE; ++count)
+	{
+		const uint8_t* record = data + m_pos;
+		const uint32_t size = m_pos + RECORD_HEADER_SIZE <= fileSize ? Read<uint32_t>(record) : 0;
+		if (size < RECORD_HEADER_SIZE || m_pos + size > fileSize)
+		{
+			WriteChatf(PLUGIN_MSG "Replay finished, delivered \aw%llu\ax message(s), skipped \aw%llu\ax.",
+				static_cast<unsigned long long>(m_delivered), static_cast<unsigned long long>(m_skipped));
+			Stop();
+			return;
+		}
+
+		const uint8_t* in = record + sizeof(uint32_t);
+		const int64_t time = Read<int64_t>(in);
+		if (m_speed > 0 && (time - m_firstTime) / m_speed > elapsed)
+			return;
+
+		const auto direction = static_cast<CaptureDirection>(in[sizeof(int64_t)]);
+		const uint16_t channelSize = Read<uint16_t>(in + sizeof(int64_t) + 2);
+		const uint16_t peerSize = Read<uint16_t>(in + sizeof(int64_t) + 2 + sizeof(uint16_t));
+		const char* channelName = reinterpret_cast<const char*>(record + RECORD_HEADER_SIZE);
+		const char* peer = channelName + channelSize;
+		const char* payload = peer + peerSize;
+		m_pos += size;
+
+		if (RECORD_HEADER_SIZE + channelSize + peerSize > size)
+		{
+			++m_skipped;
+			continue;
+		}
+		const size_t payloadSize = size - RECORD_HEADER_SIZE - channelSize - peerSize;
+
+		Channel* channel = direction == CaptureDirection::Received
+			? FindReplayChannel(channels, std::string_view(channelName, channelSize)) : nullptr;
+		if (!channel)
+		{
+			++m_skipped;
+			continue;
+		}
+
+		channel->Replay(std::string(peer, peerSize), std::string_view(payload, payloadSize), m_run);
+		++m_delivered;
+	}
+}
+
+} // namespace remote
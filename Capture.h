@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Remote.pb.h"
+#include "mq/Plugin.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace remote {
+
+class ChannelManager;
+
+enum class CaptureDirection : uint8_t
+{
+	Received,
+	Sent,
+};
+
+// A file mapped into memory, either created at a fixed size for writing or opened read only
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { Close(m_size); }
+
+	bool Create(const std::string& path, size_t size);
+	bool OpenRead(const std::string& path);
+
+	// Unmaps the file, trimming a file opened with Create to length bytes
+	void Close(size_t length = 0);
+
+	bool IsOpen() const { return m_view != nullptr; }
+	uint8_t* GetData() const { return m_view; }
+	size_t GetSize() const { return m_size; }
+
+	// non-copyable
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+	uint8_t* m_view = nullptr;
+	size_t m_size = 0;
+	bool m_writable = false;
+};
+
+// Appends sent and received messages to a memory mapped capture file. Once a file is full it is
+// renamed to <path>.1, older captures move up by one and the oldest is deleted, so a capture never
+// takes more than maxFileSize * maxFiles of disk. See README.md for the record format.
+//
+// Files are named after a slot, the lowest one no running client holds, so a new session rotates
+// the captures of an earlier one instead of leaving them behind. The slot is held until unloading.
+class TrafficCapture
+{
+public:
+	~TrafficCapture();
+
+	// Claims a slot on first use and captures to directory/MQRemote_<slot>.rcap
+	bool Start(std::string_view directory, size_t maxFileSize, int maxFiles);
+	void Stop();
+	bool IsActive() const { return m_file.IsOpen(); }
+
+	// peer is the sender of a received message and the receiver of a sent one, empty for our broadcasts
+	void Record(CaptureDirection direction, std::string_view channel, std::string_view peer,
+		proto::remote::MessageId id, const std::string& payload);
+
+	// Serializes the message straight into the capture file
+	void Record(CaptureDirection direction, std::string_view channel, std::string_view peer,
+		const proto::remote::Message& message);
+
+	const std::string& GetPath() const { return m_path; }
+	uint64_t GetRecords() const { return m_records; }
+	uint64_t GetBytes() const { return m_bytes; }
+	uint64_t GetRotations() const { return m_rotations; }
+	uint64_t GetDropped() const { return m_dropped; }
+
+private:
+	uint8_t* BeginRecord(CaptureDirection direction, std::string_view channel, std::string_view peer,
+		proto::remote::MessageId id, size_t payloadSize);
+	void EndRecord(const uint8_t* end);
+	bool ClaimSlot();
+	bool Rotate();
+	void ShiftFiles();
+
+	HANDLE m_slotMutex = nullptr;
+	int m_slot = -1;
+	MappedFile m_file;
+	std::string m_path;
+	size_t m_maxFileSize = 0;
+	int m_maxFiles = 1;
+	size_t m_used = 0;
+
+	uint64_t m_records = 0;
+	uint64_t m_bytes = 0;
+	uint64_t m_rotations = 0;
+	uint64_t m_dropped = 0; // records larger than a whole file
+};
+
+// Feeds the received messages of a capture file back into the channels with the original
+// timing, scaled by speed. Stands in for the post office: nothing is posted or acknowledged,
+// and commands only run if asked to.
+class TrafficReplay
+{
+public:
+	bool Start(const std::string& path, double speed, bool run);
+	void Stop();
+	bool IsActive() const { return m_file.IsOpen(); }
+
+	// Delivers the messages that are due
+	void OnPulse(ChannelManager& channels);
+
+	uint64_t GetDelivered() const { return m_delivered; }
+	uint64_t GetSkipped() const { return m_skipped; }
+
+private:
+	MappedFile m_file;
+	size_t m_pos = 0;
+	int64_t m_firstTime = 0;
+	std::chrono::steady_clock::time_point m_startedAt;
+	double m_speed = 1.0; // 0 delivers as fast as possible
+	bool m_run = false;
+
+	uint64_t m_delivered = 0;
+	uint64_t m_skipped = 0; // sent messages and messages for channels that aren't open
+};
+
+} // namespace remote
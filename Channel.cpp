@@ -1,118 +1,1385 @@
 #include "Channel.h"
+#include "Capture.h"
+#include "ClockSync.h"
+#include "CommandDictionary.h"
 #include "Logger.h"
+#include "Multiplexer.h"
+#include "Observers.h"
+#include "ReceivePipeline.h"
+#include "Scheduler.h"
+#include "TopicTrie.h"
 #include "fmt/format.h"
 
 namespace remote {
 
-Channel::Channel(Logger* logger, std::string name, std::string_view sub_name)
-	: m_logger(logger)
+// wait before sending a post again that found nobody to take it
+static constexpr std::chrono::milliseconds PERSONAL_RETRY_DELAY(500);
+
+// how often heartbeats are also sent to the other Multiplex setting's mailbox, a Join always is
+static constexpr std::chrono::minutes MODE_ANNOUNCE_INTERVAL(5);
+
+// A post that never reached the receiver's channel, either not delivered at all or answered by a
+// multiplexed client that isn't in the channel
+static bool IsUndelivered(const int code)
+{
+	return code < 0 || code == NOT_JOINED_STATUS;
+}
+
+// Our process id is carried by every message we send, comparing it is cheaper than comparing names
+static bool IsFromSelf(const postoffice::Message& message)
+{
+	static const DWORD processId = GetCurrentProcessId();
+
+	if (!message.Sender)
+		return false;
+
+	if (message.Sender->PID && *message.Sender->PID != processId)
+		return false;
+
+	// process ids repeat across the machines the postoffice bridges, ours alone doesn't make it our own
+	return message.Sender->Character && IsLocalCharacter(*message.Sender->Character);
+}
+
+Channel::Channel(const ChannelContext* context, ChannelHandle handle, std::string name, std::string_view sub_name)
+	: m_context(context)
+	, m_logger(context->logger)
+	, m_handle(handle)
 	, m_name(std::move(name))
 	, m_sub_name(mq::to_lower_copy(sub_name))
 	, m_dnsName(m_sub_name.empty() ? m_name : fmt::format("{}.{}", m_name, m_sub_name))
+	, m_channelId(GetChannelId(m_dnsName))
 {
-	m_logger->Log(Logger::LogFlags::LOG_CONNECTIONS,
-		PLUGIN_MSG "Connecting (\aw%s\ax)", m_dnsName.c_str());
-		
-	m_dropbox = postoffice::AddActor(m_dnsName.c_str(), [this](const std::shared_ptr<postoffice::Message>& msg) {
-		ReceivedMessageHandler(msg);
-	});
+	m_dropbox = AddActor();
+	Announce(proto::remote::MessageId::Join);
 }
 
 Channel::~Channel()
 {
+	Flush(true);
+
+	// personal posts held back by the ack window or waiting to be retried go down with the channel
+	for (const auto& [_, receiver] : m_receivers)
+	{
+		const size_t dropped = receiver->waiting.size() + receiver->retrying.size();
+		if (dropped > 0)
+		{
+			m_logger->Log(Logger::LogFlags::LOG_ERROR,
+				PLUGIN_MSG "Dropped %d post(s) to \ay%s->%s\ax, the channel closed before they were sent.",
+				static_cast<int>(dropped), m_dnsName.c_str(), receiver->name.c_str());
+		}
+	}
+
+	Announce(proto::remote::MessageId::Leave);
+	m_context->commands->Detach(this);
+	m_context->scheduler->Detach(this);
+
 	m_logger->Log(Logger::LogFlags::LOG_CONNECTIONS,
 		PLUGIN_MSG "Disconnecting (\aw%s\ax)", m_dnsName.c_str());
 
-	m_dropbox.Remove();
+	RemovePreviousActor();
+	m_context->multiplexer->Detach(this, m_dnsName, m_dropbox);
+}
+
+postoffice::DropboxAPI Channel::AddActor()
+{
+	m_logger->Log(Logger::LogFlags::LOG_CONNECTIONS,
+		PLUGIN_MSG "Connecting (\aw%s\ax)", m_dnsName.c_str());
+
+	return m_context->multiplexer->Attach(this, m_dnsName);
+}
+
+void Channel::RemovePreviousActor()
+{
+	if (m_previousDnsName.empty())
+		return;
+
+	m_logger->Log(Logger::LogFlags::LOG_CONNECTIONS,
+		PLUGIN_MSG "Disconnecting (\aw%s\ax)", m_previousDnsName.c_str());
+
+	m_context->multiplexer->Detach(this, m_previousDnsName, m_previousDropbox);
+	m_previousDnsName.clear();
+}
+
+void Channel::Rebind(std::string_view sub_name)
+{
+	std::string lowered = mq::to_lower_copy(sub_name);
+	if (lowered == m_sub_name)
+		return;
+
+	// batched commands go out to the address they were sent to
+	Flush(true);
+	Announce(proto::remote::MessageId::Leave);
+
+	// only the most recent mailbox is kept, one rebind after another leaves the oldest behind
+	RemovePreviousActor();
+	m_previousDropbox = m_dropbox;
+	m_previousDnsName = std::move(m_dnsName);
+	m_previousUntil = std::chrono::steady_clock::now() + m_context->personal.ackTimeout;
+
+	// the new mailbox is registered before anything is sent to it
+	m_sub_name = std::move(lowered);
+	m_dnsName = m_sub_name.empty() ? m_name : fmt::format("{}.{}", m_name, m_sub_name);
+	m_channelId = GetChannelId(m_dnsName);
+	m_dropbox = AddActor();
+
+	// members of the old mailbox aren't members of the new one
+	ResetMembers();
+	Announce(proto::remote::MessageId::Join);
+}
+
+void Channel::Announce(const proto::remote::MessageId id)
+{
+	if (m_context->presence.interval.count() == 0)
+		return;
+
+	proto::remote::Message message;
+	message.set_id(id);
+	if (id != proto::remote::MessageId::Leave)
+	{
+		message.set_multiplexed(m_context->multiplexer->IsEnabled());
+	}
+	PostDirect({}, message);
+
+	// also tell clients with the other Multiplex setting, they can't reach us and warn about it. Only
+	// there to catch a setup mistake, so heartbeats go there far less often than to the channel.
+	const auto now = std::chrono::steady_clock::now();
+	if (!m_dnsName.empty() && (id == proto::remote::MessageId::Join
+		|| (id == proto::remote::MessageId::Heartbeat && now >= m_nextModeAnnounce)))
+	{
+		postoffice::Address address;
+		address.Server = GetServerShortName();
+		address.Mailbox = std::string(m_context->multiplexer->IsEnabled() ? std::string_view(m_dnsName) : MULTIPLEX_MAILBOX);
+		message.set_channel(m_channelId);
+
+		CountSent(message.ByteSizeLong());
+		m_dropbox.Post(address, message);
+		m_nextModeAnnounce = now + MODE_ANNOUNCE_INTERVAL;
+	}
+
+	m_nextHeartbeat = now + m_context->presence.interval;
+}
+
+void Channel::UpdatePresence(PeerInfo& peer, const proto::remote::MessageId id)
+{
+	peer.lastSeen = std::chrono::steady_clock::now();
+
+	switch (id)
+	{
+	case proto::remote::MessageId::Join:
+	case proto::remote::MessageId::Heartbeat:
+		peer.announces = true;
+		SetPresent(peer, true);
+		break;
+
+	case proto::remote::MessageId::Leave:
+		peer.announces = true;
+		SetPresent(peer, false);
+		break;
+
+	default:
+		SetPresent(peer, true);
+		break;
+	}
+}
+
+void Channel::SetPresent(PeerInfo& peer, const bool present)
+{
+	if (peer.present == present)
+		return;
+
+	peer.present = present;
+	if (present)
+		++m_memberCount;
+	else
+		--m_memberCount;
+}
+
+void Channel::ExpireMembers()
+{
+	const auto now = std::chrono::steady_clock::now();
+	for (auto& [_, peer] : m_peers)
+	{
+		if (peer->present && now - peer->lastSeen >= m_context->presence.timeout)
+		{
+			SetPresent(*peer, false);
+		}
+	}
+}
+
+void Channel::ResetMembers()
+{
+	for (auto& [_, peer] : m_peers)
+	{
+		peer->present = false;
+		peer->announces = false;
+	}
+
+	m_memberCount = 0;
+}
+
+bool Channel::IsMember(std::string_view name) const
+{
+	if (IsLocalCharacter(name))
+		return true;
+
+	const PeerInfo* peer = FindPeer(name);
+	return peer && peer->present;
+}
+
+bool Channel::IsKnownAbsent(std::string_view name) const
+{
+	const PeerInfo* peer = FindPeer(name);
+	if (!peer || peer->present || !peer->announces)
+		return false;
+
+	// a character that just left is likely zoning, posts to it are retried for the forward TTL
+	return std::chrono::steady_clock::now() - peer->lastSeen >= m_context->personal.forwardTTL;
 }
 
-void Channel::SendCommand(std::string command, const bool includeSelf)
+void Channel::SendCommand(std::string command, const bool includeSelf, SendOptions options)
 {
 	m_logger->Log(Logger::LogFlags::LOG_SEND,
 		PLUGIN_MSG "\a-t[ \ax\at-->\ax\a-t(%s) ]\ax \aw%s\ax", m_dnsName.c_str(), command.c_str());
 
-	postoffice::Address address;
-	address.Server = GetServerShortName();
-
-	if (!m_dnsName.empty())
+	const Lane lane = options.urgent ? Lane::Urgent : m_defaultLane;
+	if (options.executeAt != 0)
 	{
-		address.Mailbox = m_dnsName;
+		m_context->scheduler->Track(options.executeAt);
 	}
 
-	proto::remote::Message message;
-	message.set_id(proto::remote::MessageId::Broadcast);
-	message.set_command(std::move(command));
-	message.set_includeself(includeSelf);
+	if (!AdmitSend(lane))
+	{
+		HoldSend(lane, { {}, std::move(command), std::move(options.key), includeSelf, false, nullptr, options.executeAt,
+			std::move(options.topic) });
+		return;
+	}
 
-	m_dropbox.Post(address, message);
+	SendBroadcast(std::move(command), includeSelf, lane, std::move(options.key), options.executeAt, std::move(options.topic));
 }
 
-void Channel::SendCommand(std::string receiver, std::string command)
+void Channel::SendCommand(std::string receiver, std::string command, SendOptions options)
 {
 	m_logger->Log(Logger::LogFlags::LOG_SEND, PLUGIN_MSG "\a-t[ \ax\at-->\ax\a-t(%s->%s) ]\ax \aw%s\ax",
 		m_dnsName.c_str(), receiver.c_str(), command.c_str());
 
+	const Lane lane = options.urgent ? Lane::Urgent : m_defaultLane;
+	if (IsLocalCharacter(receiver))
+	{
+		QueueLocal(std::move(command), lane, std::move(options.key), options.executeAt);
+		return;
+	}
+
+	// posting to a character that left the channel would only time out
+	if (IsKnownAbsent(receiver))
+	{
+		++m_stats.absentSends;
+		ChannelTraffic::Add(m_traffic.failures);
+		m_logger->Log(Logger::LogFlags::LOG_ERROR,
+			PLUGIN_MSG "\ay%s\ax is not on \ay%s\ax, command not sent.", receiver.c_str(), m_dnsName.c_str());
+		return;
+	}
+
+	if (options.executeAt != 0)
+	{
+		m_context->scheduler->Track(options.executeAt);
+	}
+
+	if (!AdmitSend(lane))
+	{
+		ThrottledSend send{ {}, std::move(command), std::move(options.key) };
+		send.receivers.push_back(std::move(receiver));
+		send.executeAt = options.executeAt;
+		HoldSend(lane, std::move(send));
+		return;
+	}
+
+	SendPersonal(std::move(receiver), std::move(command), lane, std::move(options.key), options.executeAt);
+}
+
+void Channel::SendCommand(std::vector<std::string> receivers, std::string command, MultiSendCallback onComplete,
+	SendOptions options)
+{
+	// a name listed twice is only sent to once
+	for (auto it = receivers.begin(); it != receivers.end();)
+	{
+		if (it->empty() || std::any_of(receivers.begin(), it, [&](const std::string& name) { return mq::ci_equals(name, *it); }))
+			it = receivers.erase(it);
+		else
+			++it;
+	}
+
+	if (receivers.empty())
+		return;
+
+	const Lane lane = options.urgent ? Lane::Urgent : m_defaultLane;
+	if (options.executeAt != 0)
+	{
+		m_context->scheduler->Track(options.executeAt);
+	}
+
+	if (!AdmitSend(lane))
+	{
+		HoldSend(lane, { std::move(receivers), std::move(command), std::move(options.key), false, true, std::move(onComplete),
+			options.executeAt });
+		return;
+	}
+
+	SendMulti(std::move(receivers), std::move(command), std::move(onComplete), lane, std::move(options.key), options.executeAt);
+}
+
+void Channel::SendBroadcast(std::string command, const bool includeSelf, const Lane lane, std::string key,
+	const int64_t executeAt, std::string topic)
+{
+	// our own copy runs from the command queue this frame instead of making the round trip
+	if (includeSelf)
+	{
+		QueueLocal(command, lane, key, executeAt);
+	}
+
+	AddToBatch({}, std::move(command), false, lane, std::move(key), executeAt, std::move(topic));
+}
+
+void Channel::SendPersonal(std::string receiver, std::string command, const Lane lane, std::string key,
+	const int64_t executeAt)
+{
+	AddToBatch(std::move(receiver), std::move(command), false, lane, std::move(key), executeAt, {});
+}
+
+void Channel::SendMulti(std::vector<std::string> receivers, std::string command, MultiSendCallback onComplete,
+	const Lane lane, std::string key, const int64_t executeAt)
+{
+	// we run our own copy locally, it is reported as succeeded. Characters known to have left
+	// the channel are reported as failed without posting to them.
+	MultiSendReport settled;
+	for (auto it = receivers.begin(); it != receivers.end();)
+	{
+		if (IsLocalCharacter(*it))
+		{
+			QueueLocal(command, lane, key, executeAt);
+			settled.results.push_back(MultiSendReport::Result::Succeeded);
+		}
+		else if (IsKnownAbsent(*it))
+		{
+			++m_stats.absentSends;
+			settled.results.push_back(MultiSendReport::Result::Failed);
+		}
+		else
+		{
+			++it;
+			continue;
+		}
+
+		settled.recipients.push_back(std::move(*it));
+		it = receivers.erase(it);
+	}
+
+	if (receivers.empty())
+	{
+		MultiSend send;
+		send.report = std::move(settled);
+		send.report.command = std::move(command);
+		send.onComplete = std::move(onComplete);
+		CompleteMultiSend(send);
+		return;
+	}
+
+	std::string joined;
+	for (const std::string& receiver : receivers)
+	{
+		joined.append(joined.empty() ? "" : ",").append(receiver);
+	}
+
+	m_logger->Log(Logger::LogFlags::LOG_SEND, PLUGIN_MSG "\a-t[ \ax\at-->\ax\a-t(%s->%s) ]\ax \aw%s\ax",
+		m_dnsName.c_str(), joined, command.c_str());
+
+	// batched commands to the same receivers were sent first
+	Flush(true);
+
+	auto send = std::make_shared<MultiSend>();
+	send->channel = this;
+	send->pending = receivers.size();
+	send->report.command = command;
+	send->report.results.resize(receivers.size(), MultiSendReport::Result::Pending);
+	send->onComplete = std::move(onComplete);
+
+	const bool compress = CanCompressFor(receivers);
+	PendingBatch batch{ {}, false };
+	batch.commands.push_back(std::move(command));
+	batch.lane = lane;
+	batch.executeAt = executeAt;
+	if (!key.empty())
+	{
+		batch.keys.push_back(std::move(key));
+	}
+
+	proto::remote::Message message;
+	BuildMessage(batch, message, compress);
+	message.set_id(proto::remote::MessageId::Personal);
+	for (const std::string& receiver : receivers)
+	{
+		message.add_recipients(receiver);
+	}
+
+	send->sentAt = std::chrono::steady_clock::now();
+	send->sentTime = message.senttime();
+	send->report.recipients = receivers;
+	for (size_t i = 0; i < settled.recipients.size(); ++i)
+	{
+		send->report.recipients.push_back(std::move(settled.recipients[i]));
+		send->report.results.push_back(settled.results[i]);
+	}
+
+	// encoded once, the same payload goes to every receiver
+	const std::string payload = message.SerializeAsString();
+	m_context->capture->Record(CaptureDirection::Sent, m_dnsName, joined, message.id(), payload);
+	CountSent(payload.size(), receivers.size());
+
+	// tracked before posting, a failed post calls back right away
+	m_multiSends.push_back(send);
+
 	postoffice::Address address;
 	address.Server = GetServerShortName();
-	address.Character = receiver;
 	if (!m_dnsName.empty())
 	{
-		address.Mailbox = m_dnsName;
+		address.Mailbox = std::string(m_context->multiplexer->GetMailbox(m_dnsName));
 	}
 
-	proto::remote::Message message;
-	message.set_id(proto::remote::MessageId::Personal);
-	message.set_command(std::move(command));
+	for (size_t i = 0; i < receivers.size(); ++i)
+	{
+		address.Character = receivers[i];
+		m_dropbox.Post(address, payload,
+			[weak = std::weak_ptr<MultiSend>(send), i](int code, const std::shared_ptr<postoffice::Message>& reply)
+		{
+			if (std::shared_ptr<MultiSend> state = weak.lock())
+			{
+				state->channel->OnMultiReply(*state, i, code, reply);
+			}
+		});
+	}
+}
+
+void Channel::QueueLocal(std::string command, const Lane lane, std::string key, const int64_t executeAt)
+{
+	QueuedCommand queued{ this, std::move(command) };
+	queued.lane = lane;
+	queued.key = std::move(key);
+
+	if (executeAt != 0)
+	{
+		queued.executeAt = executeAt;
+		m_context->scheduler->Schedule(executeAt, std::move(queued));
+		return;
+	}
+
+	m_context->commands->Push(std::move(queued));
+}
+
+bool Channel::AdmitSend(const Lane lane)
+{
+	// once anything is held back, later sends queue behind it to keep their order
+	const size_t index = static_cast<size_t>(lane);
+	return m_throttled[index].empty()
+		&& m_sendBuckets[index].TryTake(m_context->lanes.send[index], std::chrono::steady_clock::now());
+}
 
-	m_dropbox.Post(address, message,
-		[receiverStr = std::move(receiver), dnsName = m_dnsName, this](int code, const std::shared_ptr<postoffice::Message>&)
+void Channel::HoldSend(const Lane lane, ThrottledSend&& send)
+{
+	LaneStats& stats = m_stats.lanes[static_cast<size_t>(lane)];
+	std::deque<ThrottledSend>& held = m_throttled[static_cast<size_t>(lane)];
+	if (held.size() >= m_context->lanes.sendBacklog)
 	{
-		if (code < 0)
+		++stats.dropped;
+		m_logger->Log(Logger::LogFlags::LOG_ERROR,
+			PLUGIN_MSG "Dropped command to \ay%s\ax, too many held back by the send limit.", m_dnsName.c_str());
+
+		if (send.onComplete)
 		{
-			m_logger->Log(Logger::LogFlags::LOG_ERROR,
-				PLUGIN_MSG "Failed sending command to \ay%s->%s\ax.", dnsName.c_str(), receiverStr.c_str());
+			MultiSendReport report{ std::move(send.command), std::move(send.receivers) };
+			report.results.resize(report.recipients.size(), MultiSendReport::Result::Failed);
+			send.onComplete(report);
 		}
-	});
+		return;
+	}
+
+	// a held send is replaced by a later one to the same address with the same key
+	const bool identical = m_context->commandQueue.coalesceIdentical;
+	if (!send.key.empty() || identical)
+	{
+		auto it = std::find_if(held.begin(), held.end(), [&](const ThrottledSend& other) {
+			return other.multi == send.multi && other.includeSelf == send.includeSelf && !other.onComplete
+				&& std::equal(other.receivers.begin(), other.receivers.end(), send.receivers.begin(), send.receivers.end(),
+					[](const std::string& a, const std::string& b) { return mq::ci_equals(a, b); })
+				&& Coalesces(send.key, send.command, other.key, other.command, identical);
+		});
+		if (it != held.end())
+		{
+			held.erase(it);
+			++m_stats.coalesced;
+		}
+	}
+
+	++stats.throttled;
+	held.push_back(std::move(send));
 }
 
-void Channel::ReceivedMessageHandler(const std::shared_ptr<postoffice::Message>& message)
+void Channel::ReleaseThrottled()
 {
-	mq::proto::remote::Message msg;
-	msg.ParseFromString(*message->Payload);
+	const auto now = std::chrono::steady_clock::now();
 
-	switch (msg.id())
+	for (size_t i = 0; i < LANE_COUNT; ++i)
 	{
-	case mq::proto::remote::MessageId::Broadcast:
+		const Lane lane = static_cast<Lane>(i);
+		std::deque<ThrottledSend>& held = m_throttled[i];
+		while (!held.empty() && m_sendBuckets[i].TryTake(m_context->lanes.send[i], now))
 		{
-			if (message->Sender && message->Sender->Character.has_value())
-			{
-				if (!pLocalPlayer)
-					return;
+			ThrottledSend send = std::move(held.front());
+			held.pop_front();
 
-				if (mq::ci_equals(message->Sender->Character.value(), pLocalPlayer->Name)
-					&& msg.includeself() == false)
-				{
-					return;
-				}
+			if (send.multi)
+			{
+				SendMulti(std::move(send.receivers), std::move(send.command), std::move(send.onComplete), lane, std::move(send.key),
+					send.executeAt);
+			}
+			else if (send.receivers.empty())
+			{
+				SendBroadcast(std::move(send.command), send.includeSelf, lane, std::move(send.key), send.executeAt,
+					std::move(send.topic));
+			}
+			else
+			{
+				SendPersonal(std::move(send.receivers.front()), std::move(send.command), lane, std::move(send.key), send.executeAt);
 			}
+		}
+	}
+}
 
-			m_logger->Log(Logger::LogFlags::LOG_RECEIVE, PLUGIN_MSG "\a-t[ \ax\at<--\ax\a-t(%s) ]\ax \aw%s\ax",
-				m_dnsName.c_str(), msg.command().c_str());
+void Channel::AddToBatch(std::string receiver, std::string command, const bool includeSelf, const Lane lane, std::string key,
+	const int64_t executeAt, std::string topic)
+{
+	// urgent commands don't wait for a batch to fill, scheduled ones carry a time of their own and topic ones a topic
+	const BatchOptions& options = m_context->batch;
+	if (!options.enabled || lane == Lane::Urgent || executeAt != 0 || !topic.empty())
+	{
+		PendingBatch batch{ std::move(receiver), includeSelf };
+		batch.lane = lane;
+		batch.executeAt = executeAt;
+		batch.topic = std::move(topic);
+		batch.Add(std::move(command), std::move(key));
+		PostBatch(batch);
+		return;
+	}
 
-			DoCommand(msg.command().c_str());
-		}
-		break;
+	if (m_pending.empty())
+	{
+		m_flushAt = std::chrono::steady_clock::now() + options.flushInterval;
+	}
 
-	case mq::proto::remote::MessageId::Personal:
-		{
-			m_logger->Log(Logger::LogFlags::LOG_RECEIVE, PLUGIN_MSG "\a-t[ \ax\at<--\ax\a-t(%s<-%s) ]\ax \aw%s\ax",
-				m_dnsName.c_str(), message->Sender->Character.value().c_str(), msg.command().c_str());
-				
-			DoCommand(msg.command().c_str());
+	// commands are grouped per address, keeping the order they were sent in
+	auto it = std::find_if(m_pending.begin(), m_pending.end(), [&](const PendingBatch& batch) {
+		return batch.includeSelf == includeSelf && mq::ci_equals(batch.receiver, receiver);
+	});
+	if (it == m_pending.end())
+	{
+		it = m_pending.insert(m_pending.end(), PendingBatch{ std::move(receiver), includeSelf });
+	}
 
+	// last writer wins, the command it replaces is never sent
+	if (it->Coalesce(key, command, m_context->commandQueue.coalesceIdentical))
+	{
+		++m_stats.coalesced;
+	}
+
+	it->Add(std::move(command), std::move(key));
+	if (it->commands.size() >= options.maxSize)
+	{
+		PostBatch(*it);
+		m_pending.erase(it);
+	}
+}
+
+void Channel::Flush(const bool force)
+{
+	if (m_pending.empty())
+		return;
+
+	if (!force && std::chrono::steady_clock::now() < m_flushAt)
+		return;
+
+	for (PendingBatch& batch : m_pending)
+	{
+		PostBatch(batch);
+	}
+
+	m_pending.clear();
+}
+
+void Channel::OnPulse()
+{
+	ReleaseThrottled();
+	Flush();
+	RetryPersonal();
+	ExpirePersonal();
+
+	if (m_context->presence.interval.count() > 0 && std::chrono::steady_clock::now() >= m_nextHeartbeat)
+	{
+		ExpireMembers();
+		Announce(proto::remote::MessageId::Heartbeat);
+	}
+
+	if (!m_previousDnsName.empty() && std::chrono::steady_clock::now() >= m_previousUntil)
+	{
+		RemovePreviousActor();
+	}
+}
+
+void Channel::BuildMessage(PendingBatch& batch, proto::remote::Message& message, const bool compress)
+{
+	message.set_dictionary(COMMAND_DICTIONARY_VERSION);
+	message.set_senttime(WallClockMicros());
+	if (m_context->multiplexer->IsEnabled())
+	{
+		message.set_channel(m_channelId);
+	}
+	if (batch.lane == Lane::Urgent)
+	{
+		message.set_urgent(true);
+	}
+	if (batch.executeAt != 0)
+	{
+		message.set_executeat(batch.executeAt);
+	}
+	if (!batch.topic.empty())
+	{
+		message.set_topic(std::move(batch.topic));
+	}
+
+	for (std::string& command : batch.commands)
+	{
+		m_stats.commandBytes += command.size();
+
+		if (compress)
+		{
+			uint32_t prefix = FindCommandPrefix(command);
+			command.erase(0, GetCommandPrefix(prefix).size());
+			message.add_prefixes(prefix);
+		}
+
+		m_stats.encodedBytes += command.size() + (compress ? 1 : 0);
+	}
+
+	for (std::string& key : batch.keys)
+	{
+		message.add_keys(std::move(key));
+	}
+
+	if (batch.commands.size() == 1)
+	{
+		message.set_command(std::move(batch.commands.front()));
+	}
+	else
+	{
+		for (std::string& command : batch.commands)
+		{
+			message.add_commands(std::move(command));
+		}
+	}
+
+	m_stats.commandsSent += batch.commands.size();
+	m_stats.lanes[static_cast<size_t>(batch.lane)].sent += batch.commands.size();
+	++m_stats.postsSent;
+}
+
+void Channel::PostBatch(PendingBatch& batch)
+{
+	if (batch.receiver.empty())
+	{
+		postoffice::Address address;
+		address.Server = GetServerShortName();
+
+		if (!m_dnsName.empty())
+		{
+			address.Mailbox = std::string(m_context->multiplexer->GetMailbox(m_dnsName));
+		}
+
+		proto::remote::Message message;
+		BuildMessage(batch, message, CanCompressFor(batch.receiver));
+		message.set_id(proto::remote::MessageId::Broadcast);
+		message.set_includeself(batch.includeSelf);
+		message.set_sequence(m_broadcastSequence++);
+
+		m_context->capture->Record(CaptureDirection::Sent, m_dnsName, {}, message);
+		CountSent(message.ByteSizeLong());
+		m_dropbox.Post(address, message);
+		return;
+	}
+
+	std::shared_ptr<ReceiverState>& receiver = m_receivers[batch.receiver];
+	if (!receiver)
+	{
+		receiver = std::make_shared<ReceiverState>();
+		receiver->channel = this;
+		receiver->name = batch.receiver;
+	}
+
+	// posts beyond the ack window wait for earlier ones to be answered
+	if (receiver->inFlight.size() >= m_context->personal.ackWindow || !receiver->waiting.empty()
+		|| !receiver->retrying.empty())
+	{
+		if (receiver->waiting.size() >= m_context->personal.maxWaiting)
+		{
+			++receiver->dropped;
+			m_logger->Log(Logger::LogFlags::LOG_ERROR,
+				PLUGIN_MSG "Dropped %d command(s) to \ay%s->%s\ax, too many waiting for replies.",
+				static_cast<int>(batch.commands.size()), m_dnsName.c_str(), receiver->name.c_str());
+			return;
+		}
+
+		// urgent commands wait ahead of bulk ones
+		auto position = batch.lane != Lane::Urgent ? receiver->waiting.end()
+			: std::find_if(receiver->waiting.begin(), receiver->waiting.end(),
+				[](const PendingBatch& waiting) { return waiting.lane != Lane::Urgent; });
+		receiver->waiting.insert(position, std::move(batch));
+		return;
+	}
+
+	PostPersonal(receiver, batch);
+}
+
+void Channel::PostPersonal(const std::shared_ptr<ReceiverState>& receiver, PendingBatch& batch)
+{
+	proto::remote::Message message;
+	BuildMessage(batch, message, CanCompressFor(receiver->name));
+	message.set_id(proto::remote::MessageId::Personal);
+
+	const uint32_t sequence = receiver->nextSequence++;
+	message.set_sequence(sequence);
+
+	m_context->capture->Record(CaptureDirection::Sent, m_dnsName, receiver->name, message);
+
+	const std::string payload = message.SerializeAsString();
+	const auto now = std::chrono::steady_clock::now();
+	receiver->inFlight.push_back({ sequence, now, message.senttime(), now,
+		m_context->personal.forwardTTL.count() > 0 ? payload : std::string() });
+
+	PostPersonalPayload(receiver, payload, sequence);
+}
+
+void Channel::PostPersonalPayload(const std::shared_ptr<ReceiverState>& receiver, const std::string& payload, uint32_t sequence)
+{
+	postoffice::Address address;
+	address.Server = GetServerShortName();
+	address.Character = receiver->name;
+
+	if (!m_dnsName.empty())
+	{
+		address.Mailbox = std::string(m_context->multiplexer->GetMailbox(m_dnsName));
+	}
+
+	// the callback only holds a weak reference and a sequence number, small enough to
+	// not need an allocation of its own
+	CountSent(payload.size());
+	m_dropbox.Post(address, payload,
+		[weak = std::weak_ptr<ReceiverState>(receiver), sequence](int code, const std::shared_ptr<postoffice::Message>& reply)
+	{
+		if (std::shared_ptr<ReceiverState> state = weak.lock())
+		{
+			state->channel->OnPersonalReply(*state, sequence, code, reply);
+		}
+	});
+}
+
+void Channel::OnPersonalReply(ReceiverState& receiver, uint32_t sequence, int code,
+	const std::shared_ptr<postoffice::Message>& reply)
+{
+	auto it = std::find_if(receiver.inFlight.begin(), receiver.inFlight.end(),
+		[sequence](const ReceiverState::InFlight& post) { return post.sequence == sequence; });
+	if (it == receiver.inFlight.end())
+		return; // already timed out
+
+	const auto now = std::chrono::steady_clock::now();
+	auto latency = now - it->sentAt;
+	const int64_t sentTime = it->sentTime;
+
+	// a receiver that is zoning or logging in isn't there to take it, try again for a while
+	// one that answered it isn't in the channel won't be either, that fails at once
+	if (code < 0 && !it->payload.empty() && now - it->firstSentAt < m_context->personal.forwardTTL)
+	{
+		ReceiverState::InFlight retry = std::move(*it);
+		receiver.inFlight.erase(it);
+
+		retry.sentAt = now + PERSONAL_RETRY_DELAY;
+		receiver.retrying.push_back(std::move(retry));
+		++receiver.retried;
+		return;
+	}
+
+	receiver.inFlight.erase(it);
+
+	if (IsUndelivered(code) || code == REFUSED_STATUS)
+	{
+		++receiver.failed;
+		ChannelTraffic::Add(m_traffic.failures);
+		m_logger->Log(Logger::LogFlags::LOG_ERROR, code == REFUSED_STATUS
+			? PLUGIN_MSG "\ay%s->%s\ax dropped a command without running it."
+			: PLUGIN_MSG "Failed sending command to \ay%s->%s\ax.", m_dnsName.c_str(), receiver.name.c_str());
+	}
+	else
+	{
+		++receiver.acked;
+		receiver.latency.Record(std::chrono::duration_cast<std::chrono::microseconds>(latency));
+
+		// the reply tells us which dictionary the receiver knows
+		proto::remote::Message msg;
+		if (reply && reply->Payload && msg.ParseFromString(*reply->Payload))
+		{
+			UpdatePresence(*UpdatePeer(receiver.name, msg), msg.id());
+
+			if (msg.has_receivetime())
+			{
+				m_context->clocks->AddSample(receiver.name, sentTime, msg.receivetime(), WallClockMicros());
+			}
+		}
+	}
+
+	ReleaseWaiting(m_receivers[receiver.name]);
+}
+
+void Channel::RetryPersonal()
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	for (auto& [_, receiver] : m_receivers)
+	{
+		if (receiver->retrying.empty())
+			continue;
+
+		// retries go out in their original order, once the first is due
+		if (receiver->retrying.front().sentAt > now)
+			continue;
+
+		// a post that fails right away is queued again behind these
+		for (size_t count = receiver->retrying.size(); count > 0 && !receiver->retrying.empty(); --count)
+		{
+			ReceiverState::InFlight post = std::move(receiver->retrying.front());
+			receiver->retrying.pop_front();
+
+			post.sentAt = now;
+			const uint32_t sequence = post.sequence;
+			receiver->inFlight.push_back(std::move(post));
+
+			// posted from a copy, a failed post can call back and move it again
+			const std::string payload = receiver->inFlight.back().payload;
+			PostPersonalPayload(receiver, payload, sequence);
+		}
+
+		ReleaseWaiting(receiver);
+	}
+}
+
+void Channel::ReleaseWaiting(const std::shared_ptr<ReceiverState>& receiver)
+{
+	while (!receiver->waiting.empty() && receiver->retrying.empty()
+		&& receiver->inFlight.size() < m_context->personal.ackWindow)
+	{
+		// pop before posting, a failed post can call back into here
+		PendingBatch batch = std::move(receiver->waiting.front());
+		receiver->waiting.pop_front();
+
+		PostPersonal(receiver, batch);
+	}
+}
+
+void Channel::OnMultiReply(MultiSend& send, const size_t index, const int code,
+	const std::shared_ptr<postoffice::Message>& reply)
+{
+	MultiSendReport::Result& result = send.report.results[index];
+	if (result != MultiSendReport::Result::Pending)
+		return;
+
+	const std::string& name = send.report.recipients[index];
+	if (IsUndelivered(code) || code == REFUSED_STATUS)
+	{
+		result = MultiSendReport::Result::Failed;
+	}
+	else
+	{
+		result = MultiSendReport::Result::Succeeded;
+
+		proto::remote::Message msg;
+		if (reply && reply->Payload && msg.ParseFromString(*reply->Payload))
+		{
+			UpdatePresence(*UpdatePeer(name, msg), msg.id());
+
+			if (msg.has_receivetime())
+			{
+				m_context->clocks->AddSample(name, send.sentTime, msg.receivetime(), WallClockMicros());
+			}
+		}
+	}
+
+	if (--send.pending == 0)
+	{
+		CompleteMultiSend(send);
+	}
+}
+
+void Channel::CompleteMultiSend(MultiSend& send)
+{
+	// keeps the send alive until the report is done
+	std::shared_ptr<MultiSend> keep;
+	auto it = std::find_if(m_multiSends.begin(), m_multiSends.end(),
+		[&](const std::shared_ptr<MultiSend>& pending) { return pending.get() == &send; });
+	if (it != m_multiSends.end())
+	{
+		keep = std::move(*it);
+		m_multiSends.erase(it);
+	}
+
+	const MultiSendReport& report = send.report;
+	ChannelTraffic::Add(m_traffic.failures,
+		report.Count(MultiSendReport::Result::Failed) + report.Count(MultiSendReport::Result::TimedOut));
+
+	if (send.onComplete)
+	{
+		send.onComplete(report);
+		return;
+	}
+
+	auto names = [&](MultiSendReport::Result result) {
+		std::string list;
+		for (size_t i = 0; i < report.recipients.size(); ++i)
+		{
+			if (report.results[i] == result)
+			{
+				list.append(list.empty() ? "" : ", ").append(report.recipients[i]);
+			}
+		}
+		return list.empty() ? std::string("-") : list;
+	};
+
+	using enum MultiSendReport::Result;
+	const bool allSucceeded = report.Count(Succeeded) == report.recipients.size();
+	m_logger->Log(allSucceeded ? Logger::LogFlags::LOG_SEND : Logger::LogFlags::LOG_ERROR,
+		PLUGIN_MSG "\a-t[ \ax\at-->\ax\a-t(%s) ]\ax \aw%s\ax succeeded: \ag%s\ax failed: \ar%s\ax timed out: \ar%s\ax",
+		m_dnsName.c_str(), report.command.c_str(), names(Succeeded), names(Failed), names(TimedOut));
+}
+
+void Channel::ExpirePersonal()
+{
+	const auto expired = std::chrono::steady_clock::now() - m_context->personal.ackTimeout;
+
+	while (!m_multiSends.empty() && m_multiSends.front()->sentAt < expired)
+	{
+		MultiSend& send = *m_multiSends.front();
+		for (MultiSendReport::Result& result : send.report.results)
+		{
+			if (result == MultiSendReport::Result::Pending)
+			{
+				result = MultiSendReport::Result::TimedOut;
+			}
+		}
+
+		send.pending = 0;
+		CompleteMultiSend(send);
+	}
+
+	for (auto& [_, receiver] : m_receivers)
+	{
+		auto it = std::remove_if(receiver->inFlight.begin(), receiver->inFlight.end(),
+			[&](const ReceiverState::InFlight& post) { return post.sentAt < expired; });
+		if (it == receiver->inFlight.end())
+			continue;
+
+		int count = static_cast<int>(std::distance(it, receiver->inFlight.end()));
+		receiver->inFlight.erase(it, receiver->inFlight.end());
+		receiver->timedOut += count;
+		ChannelTraffic::Add(m_traffic.failures, count);
+
+		m_logger->Log(Logger::LogFlags::LOG_ERROR,
+			PLUGIN_MSG "Timed out waiting on %d send(s) to \ay%s->%s\ax.", count, m_dnsName.c_str(), receiver->name.c_str());
+
+		ReleaseWaiting(receiver);
+	}
+}
+
+bool Channel::CanCompressFor(const std::string& receiver) const
+{
+	// broadcasts also reach clients we have never heard from, an older one would run the command
+	// with its prefix missing
+	if (!m_context->compression || receiver.empty())
+		return false;
+
+	auto it = m_peers.find(receiver);
+	return it != m_peers.end() && it->second->dictionary == COMMAND_DICTIONARY_VERSION;
+}
+
+bool Channel::CanCompressFor(const std::vector<std::string>& receivers) const
+{
+	return std::all_of(receivers.begin(), receivers.end(), [&](const std::string& receiver) { return CanCompressFor(receiver); });
+}
+
+std::shared_ptr<PeerInfo>& Channel::UpdatePeer(const std::string& name, const proto::remote::Message& msg)
+{
+	auto it = m_peers.find(name);
+	if (it == m_peers.end())
+	{
+		it = m_peers.emplace(name, std::make_shared<PeerInfo>()).first;
+	}
+
+	it->second->dictionary = msg.has_dictionary() ? msg.dictionary() : 0;
+	return it->second;
+}
+
+void Channel::RecordDelivery(PeerInfo& peer, const std::string& name, const proto::remote::Message& msg)
+{
+	if (msg.has_sequence())
+	{
+		std::optional<uint32_t>& last = msg.id() == proto::remote::MessageId::Broadcast ? peer.lastBroadcast : peer.lastPersonal;
+
+		// a lower sequence number means the sender restarted
+		if (last && msg.sequence() > *last + 1)
+		{
+			peer.gaps += msg.sequence() - *last - 1;
+		}
+		last = msg.sequence();
+	}
+
+	if (msg.has_senttime())
+	{
+		// without an offset estimate the clocks are assumed to match, as they do for clients on one machine
+		auto latency = std::chrono::microseconds(WallClockMicros() - m_context->clocks->ToLocal(name, msg.senttime()));
+		peer.delivery.Record(latency);
+		m_stats.delivery.Record(latency);
+	}
+}
+
+void Channel::RecordQueueTime(PeerInfo* peer, std::chrono::microseconds elapsed)
+{
+	m_stats.queued.Record(elapsed);
+
+	if (peer)
+	{
+		peer->queued.Record(elapsed);
+	}
+}
+
+void Channel::RecordExecution(const QueuedCommand& command)
+{
+	const int64_t now = WallClockMicros();
+	m_context->scheduler->RecordLateness(std::chrono::microseconds(now - command.executeAt));
+
+	if (command.scheduledBy.empty())
+	{
+		m_context->scheduler->AddExecution(command.executeAt, now);
+		return;
+	}
+
+	// the report's sent time is when the command ran
+	proto::remote::Message report;
+	report.set_id(proto::remote::MessageId::Executed);
+	report.set_executeat(command.senderExecuteAt);
+	PostDirect(command.scheduledBy, report);
+}
+
+void Channel::PostSuccess(const std::shared_ptr<postoffice::Message>& message)
+{
+	proto::remote::Message reply;
+	reply.set_id(mq::proto::remote::MessageId::Success);
+	reply.set_dictionary(COMMAND_DICTIONARY_VERSION);
+	reply.set_receivetime(WallClockMicros());
+	m_dropbox.PostReply(message, reply);
+}
+
+void Channel::PostRefused(const std::shared_ptr<postoffice::Message>& message)
+{
+	m_dropbox.PostReply(message, std::string(), static_cast<uint8_t>(REFUSED_STATUS));
+}
+
+void Channel::PostDirect(const std::string& receiver, proto::remote::Message& message)
+{
+	// the dictionary version is what the receiver remembers about us from every message
+	message.set_dictionary(COMMAND_DICTIONARY_VERSION);
+	message.set_senttime(WallClockMicros());
+	if (m_context->multiplexer->IsEnabled())
+	{
+		message.set_channel(m_channelId);
+	}
+
+	postoffice::Address address;
+	address.Server = GetServerShortName();
+	if (!receiver.empty())
+	{
+		address.Character = receiver;
+	}
+	if (!m_dnsName.empty())
+	{
+		address.Mailbox = std::string(m_context->multiplexer->GetMailbox(m_dnsName));
+	}
+
+	m_context->capture->Record(CaptureDirection::Sent, m_dnsName, receiver, message);
+	CountSent(message.ByteSizeLong());
+	m_dropbox.Post(address, message);
+}
+
+void Channel::CountSent(const size_t bytes, const size_t posts)
+{
+	ChannelTraffic::Add(m_traffic.messagesOut, posts);
+	ChannelTraffic::Add(m_traffic.bytesOut, bytes * posts);
+}
+
+void Channel::QueueReceived(const proto::remote::Message& msg, const std::string* sender,
+	const std::shared_ptr<PeerInfo>& peer, const std::shared_ptr<postoffice::Message>& replyTo, const bool dryRun)
+{
+	if (msg.prefixes_size() > 0 && msg.dictionary() != COMMAND_DICTIONARY_VERSION)
+	{
+		m_logger->Log(Logger::LogFlags::LOG_ERROR, PLUGIN_MSG "Dropped command encoded with unknown dictionary %d on \ay%s\ax.",
+			static_cast<int>(msg.dictionary()), m_dnsName.c_str());
+		return;
+	}
+
+	// a batch carries its commands in order, a single command is sent on its own
+	const int count = std::max(msg.commands_size(), 1);
+	for (int i = 0; i < count; ++i)
+	{
+		const std::string& text = msg.commands_size() == 0 ? msg.command() : msg.commands(i);
+		std::string_view prefix = i < msg.prefixes_size() ? GetCommandPrefix(msg.prefixes(i)) : std::string_view();
+
+		std::string command;
+		command.reserve(prefix.size() + text.size());
+		command.append(prefix).append(text);
+
+		if (sender)
+		{
+			m_logger->Log(Logger::LogFlags::LOG_RECEIVE, PLUGIN_MSG "\a-t[ \ax\at<--\ax\a-t(%s<-%s) ]\ax \aw%s\ax",
+				m_dnsName.c_str(), sender->c_str(), command.c_str());
+		}
+		else
+		{
+			m_logger->Log(Logger::LogFlags::LOG_RECEIVE, PLUGIN_MSG "\a-t[ \ax\at<--\ax\a-t(%s) ]\ax \aw%s\ax",
+				m_dnsName.c_str(), command.c_str());
+		}
+
+		// the reply waits on the last command when acknowledging after run
+		QueuedCommand queued{ this, std::move(command) };
+		queued.peer = peer;
+		queued.dryRun = dryRun;
+		queued.lane = msg.urgent() ? Lane::Urgent : Lane::Bulk;
+		if (i < msg.keys_size())
+		{
+			queued.key = msg.keys(i);
+		}
+		if (replyTo && i == count - 1)
+		{
+			queued.replyTo = replyTo;
+		}
+
+		// replayed messages run as they come, the time they were scheduled for is long past
+		if (msg.has_executeat() && sender && peer)
+		{
+			// a command can be held longer than AckTimeout, its sender hears back once it is scheduled
+			if (queued.replyTo)
+			{
+				PostSuccess(queued.replyTo);
+				queued.replyTo.reset();
+			}
+
+			queued.executeAt = m_context->clocks->ToLocal(*sender, msg.executeat());
+			queued.senderExecuteAt = msg.executeat();
+			queued.scheduledBy = *sender;
+			m_context->scheduler->Schedule(queued.executeAt, std::move(queued));
+			continue;
+		}
+
+		m_context->commands->Push(std::move(queued));
+	}
+}
+
+void Channel::ReceivedMessageHandler(const std::shared_ptr<postoffice::Message>& message)
+{
+	// decoded off the game thread while the pipeline is running, see OnReceived
+	if (m_context->pipeline->Submit(m_lifetime, message))
+		return;
+
+	// everything we address to ourselves runs locally, so anything from us is our broadcast coming back
+	if (IsFromSelf(*message))
+	{
+		++m_stats.echoesDropped;
+		return;
+	}
+
+	m_received.Clear();
+	if (!m_received.ParseFromString(*message->Payload))
+		return;
+
+	Dispatch(message, m_received);
+}
+
+void Channel::OnReceived(ReceivedMessage& received)
+{
+	// the pipeline can't compare character names, it leaves what carries our process id to us
+	if (IsFromSelf(*received.message))
+	{
+		++m_stats.echoesDropped;
+		return;
+	}
+
+	if (received.echo)
+	{
+		ReceivePipeline::Parse(received);
+	}
+
+	if (received.parsed)
+	{
+		Dispatch(received.message, received.decoded);
+	}
+}
+
+void Channel::Dispatch(const std::shared_ptr<postoffice::Message>& message, const proto::remote::Message& msg)
+{
+	ChannelTraffic::Add(m_traffic.messagesIn);
+	ChannelTraffic::Add(m_traffic.bytesIn, message->Payload->size());
+
+	const bool hasSender = message->Sender && message->Sender->Character.has_value();
+	if (hasSender && m_traffic.lastSender != message->Sender->Character.value())
+	{
+		m_traffic.lastSender = message->Sender->Character.value();
+	}
+	m_context->capture->Record(CaptureDirection::Received, m_dnsName,
+		hasSender ? std::string_view(message->Sender->Character.value()) : std::string_view(), msg.id(), *message->Payload);
+
+	std::shared_ptr<PeerInfo> peer;
+	if (hasSender)
+	{
+		const std::string& name = message->Sender->Character.value();
+
+		// presence from a client with the other Multiplex setting, nothing else of it reaches us so
+		// it gets no peer entry, only a warning once
+		if (msg.has_multiplexed())
+		{
+			if (msg.multiplexed() != m_context->multiplexer->IsEnabled())
+			{
+				if (m_modeMismatches.insert(name).second)
+				{
+					m_logger->Log(Logger::LogFlags::LOG_ERROR, PLUGIN_MSG "\ay%s\ax on \ay%s\ax uses a different Multiplex setting, commands between you can't be delivered.",
+						name.c_str(), m_dnsName.c_str());
+				}
+				return;
+			}
+
+			// changed its setting since, warn again if it changes back
+			m_modeMismatches.erase(name);
+		}
+
+		peer = UpdatePeer(name, msg);
+		RecordDelivery(*peer, name, msg);
+		UpdatePresence(*peer, msg.id());
+	}
+
+	// topic broadcasts no subscription matches are dropped before they count against the sender
+	if (m_handle == ChannelHandle::Topic && msg.id() == proto::remote::MessageId::Broadcast
+		&& !m_context->topics->Matches(msg.topic()))
+	{
+		++m_stats.topicsFiltered;
+		return;
+	}
+
+	if (hasSender)
+	{
+		// commands over the sender's limit are dropped, a personal one is answered so its sender doesn't wait for it
+		const bool hasCommands = msg.id() == proto::remote::MessageId::Broadcast || msg.id() == proto::remote::MessageId::Personal;
+		if (hasCommands && !AdmitReceived(msg, message->Sender->Character.value(), *peer))
+		{
+			if (msg.id() == proto::remote::MessageId::Personal)
+			{
+				PostRefused(message);
+			}
+			return;
+		}
+	}
+
+	HandleMessage(message, msg, peer);
+}
+
+void Channel::Replay(const std::string& sender, std::string_view payload, const bool run)
+{
+	proto::remote::Message msg;
+	if (!msg.ParseFromArray(payload.data(), static_cast<int>(payload.size())))
+		return;
+
+	// peer stats are left alone, the timestamps in a capture are long past
+	if (msg.id() == proto::remote::MessageId::Broadcast || msg.id() == proto::remote::MessageId::Personal)
+	{
+		QueueReceived(msg, sender.empty() ? nullptr : &sender, nullptr, nullptr, !run);
+	}
+}
+
+bool Channel::AdmitReceived(const proto::remote::Message& msg, const std::string& sender, PeerInfo& peer)
+{
+	// every command of a batch counts against the limit
+	const size_t lane = static_cast<size_t>(msg.urgent() ? Lane::Urgent : Lane::Bulk);
+	const int count = std::max(msg.commands_size(), 1);
+	if (peer.received[lane].TryTake(m_context->lanes.receive[lane], std::chrono::steady_clock::now(), count))
+		return true;
+
+	m_stats.lanes[lane].refused += count;
+	m_logger->Log(Logger::LogFlags::LOG_ERROR,
+		PLUGIN_MSG "Refused %d command(s) from \ay%s\ax on \ay%s\ax, over the receive limit.", count, sender.c_str(), m_dnsName.c_str());
+	return false;
+}
+
+void Channel::HandleMessage(const std::shared_ptr<postoffice::Message>& message, const proto::remote::Message& msg,
+	const std::shared_ptr<PeerInfo>& peer)
+{
+	switch (msg.id())
+	{
+	case mq::proto::remote::MessageId::Broadcast:
+		{
+			const bool hasSender = message->Sender && message->Sender->Character.has_value();
+			if (hasSender && !pLocalPlayer)
+				return;
+
+			QueueReceived(msg, hasSender ? &message->Sender->Character.value() : nullptr, peer, nullptr);
+		}
+		break;
+
+	case mq::proto::remote::MessageId::Personal:
+		{
+			if (m_context->commandQueue.ackAfterRun)
+			{
+				QueueReceived(msg, &message->Sender->Character.value(), peer, message);
+			}
+			else
+			{
+				QueueReceived(msg, &message->Sender->Character.value(), peer, nullptr);
+				PostSuccess(message);
+			}
+		}
+		break;
+
+	case mq::proto::remote::MessageId::ObserveSubscribe:
+	case mq::proto::remote::MessageId::ObserveUnsubscribe:
+	case mq::proto::remote::MessageId::ObserveUpdate:
+		if (message->Sender && message->Sender->Character.has_value())
+		{
+			m_context->observers->OnMessage(*this, message->Sender->Character.value(), msg);
+		}
+		break;
+
+	case mq::proto::remote::MessageId::Executed:
+		if (message->Sender && message->Sender->Character.has_value())
+		{
+			const std::string& sender = message->Sender->Character.value();
+			m_context->scheduler->AddExecution(msg.executeat(), m_context->clocks->ToLocal(sender, msg.senttime()));
+		}
+		break;
+
+	case mq::proto::remote::MessageId::Join:
+		// the joiner learns we are here without waiting for our next heartbeat
+		if (message->Sender && message->Sender->Character.has_value())
+		{
 			proto::remote::Message reply;
-			reply.set_id(mq::proto::remote::MessageId::Success);
-			m_dropbox.PostReply(message, reply);
+			reply.set_id(proto::remote::MessageId::Heartbeat);
+			PostDirect(message->Sender->Character.value(), reply);
 		}
 		break;
 	}
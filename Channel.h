@@ -1,39 +1,473 @@
 ﻿#pragma once
 
+#include "CommandQueue.h"
+#include "Histogram.h"
+#include "NameHash.h"
 #include "Remote.pb.h"
+#include "TokenBucket.h"
 #include "mq/Plugin.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace remote {
 
+class ClockSync;
 class Logger;
+class Multiplexer;
+class Observers;
+class ReceivePipeline;
+class Scheduler;
+class TopicTrie;
+class TrafficCapture;
+struct ReceivedMessage;
+
+// Reply status for a personal message the receiver dropped without running, because its command
+// queue was full or the sender was over its receive limit. The sender counts it as a failed post.
+constexpr int REFUSED_STATUS = 101;
+
+// Interned channel name, see ChannelManager::FindHandle
+enum class ChannelHandle : uint16_t
+{
+	Global,
+	Server,
+	Group,
+	Raid,
+	Zone,
+	Topic, // shared by every topic, see TopicTrie
+	FirstCustom,
+
+	Invalid = 0xffff,
+};
+
+// Outgoing command batching, see Channel::Flush
+struct BatchOptions
+{
+	bool enabled = false;
+	std::chrono::milliseconds flushInterval{ 0 }; // 0 flushes on every pulse
+	size_t maxSize = 16;                          // a full batch is sent right away
+};
+
+// How a single command is sent, parsed from the /rc flags
+struct SendOptions
+{
+	bool urgent = false; // send in the urgent lane instead of the channel's default
+	std::string key;     // coalescing key, a later command with the same key replaces this one while it waits
+	int64_t executeAt = 0; // wall clock time the command runs at on every receiver, 0 runs it on arrival
+	std::string topic;     // on the topic channel, the topic a broadcast is published to
+};
+
+// Flow control for personal commands, see Channel::PostPersonal
+struct PersonalOptions
+{
+	size_t ackWindow = 16;                        // posts awaiting a reply per receiver
+	std::chrono::milliseconds ackTimeout{ 5000 }; // a post without a reply by then has failed
+	size_t maxWaiting = 256;                      // posts held back while the window is full
+	std::chrono::milliseconds forwardTTL{ 10000 }; // a post the receiver wasn't there for is retried this long
+};
+
+// Channel membership announcements, see Channel::Announce
+struct PresenceOptions
+{
+	std::chrono::milliseconds interval{ 5000 }; // heartbeat interval, 0 turns announcements off
+	std::chrono::milliseconds timeout{ 15000 }; // a member not heard from by then has left
+};
+
+// State shared by every channel, owned by the ChannelManager
+struct ChannelContext
+{
+	Logger* logger = nullptr;
+	CommandQueue* commands = nullptr; // received commands waiting to run
+	ClockSync* clocks = nullptr;      // clock offsets to other clients
+	TrafficCapture* capture = nullptr;
+	Observers* observers = nullptr;   // values observed on other clients and by them
+	Scheduler* scheduler = nullptr;   // received commands waiting for their scheduled time
+	ReceivePipeline* pipeline = nullptr; // decodes received messages off the game thread
+	const TopicTrie* topics = nullptr;   // topics subscribed to on the topic channel
+	Multiplexer* multiplexer = nullptr;  // registers the actors channels receive on
+	BatchOptions batch;
+	CommandQueueOptions commandQueue;
+	PersonalOptions personal;
+	LaneOptions lanes;
+	PresenceOptions presence;
+	bool compression = true; // use the command dictionary with peers that know it
+};
+
+struct ChannelStats
+{
+	uint64_t commandsSent = 0;
+	uint64_t postsSent = 0;
+
+	uint64_t echoesDropped = 0; // our own broadcasts delivered back to us
+	uint64_t coalesced = 0;     // commands replaced by a later one before they were sent
+	uint64_t absentSends = 0;   // personal sends failed right away, the receiver had left the channel
+	uint64_t topicsFiltered = 0; // topic broadcasts received that no subscription matched
+
+	uint64_t commandBytes = 0; // command text before dictionary encoding
+	uint64_t encodedBytes = 0; // command text actually sent
+
+	LatencyHistogram delivery; // sent until received, over every sender
+	LatencyHistogram queued;   // received until run
+
+	std::array<LaneStats, LANE_COUNT> lanes;
+
+	const LaneStats& GetLane(Lane lane) const { return lanes[static_cast<size_t>(lane)]; }
+	uint64_t PostsSaved() const { return commandsSent - postsSent; }
+	double CompressionRatio() const { return encodedBytes ? static_cast<double>(commandBytes) / encodedBytes : 1.0; }
+};
+
+// Live traffic counters for the settings panel. The counters are lock-free, so they can be read
+// from anywhere; the last sender is only touched on the game thread.
+struct ChannelTraffic
+{
+	std::atomic<uint64_t> messagesIn{ 0 };
+	std::atomic<uint64_t> messagesOut{ 0 };
+	std::atomic<uint64_t> bytesIn{ 0 };
+	std::atomic<uint64_t> bytesOut{ 0 };
+	std::atomic<uint64_t> failures{ 0 }; // personal commands that failed or timed out
+	std::string lastSender;
+
+	static void Add(std::atomic<uint64_t>& counter, uint64_t value = 1) { counter.fetch_add(value, std::memory_order_relaxed); }
+	static uint64_t Read(const std::atomic<uint64_t>& counter) { return counter.load(std::memory_order_relaxed); }
+};
+
+// What is known about another character seen on a channel
+struct PeerInfo
+{
+	uint32_t dictionary = 0; // command dictionary version, 0 if it has none
+
+	std::optional<uint32_t> lastBroadcast;
+	std::optional<uint32_t> lastPersonal;
+	uint64_t gaps = 0; // sequence numbers that never arrived
+	std::array<TokenBucket, LANE_COUNT> received; // receive limit per lane
+
+	std::chrono::steady_clock::time_point lastSeen;
+	bool present = false;   // heard from within the presence timeout and hasn't left
+	bool announces = false; // sends presence messages, so its absence can be trusted
+
+	LatencyHistogram delivery;
+	LatencyHistogram queued;
+};
+
+// Commands waiting to be posted together to one address
+struct PendingBatch
+{
+	std::string receiver; // empty for broadcasts
+	bool includeSelf = false;
+	std::vector<std::string> commands;
+	std::vector<std::string> keys; // coalescing key by command, empty if none of them has one
+	Lane lane = Lane::Bulk;
+	int64_t executeAt = 0;
+	std::string topic;
+
+	void Add(std::string command, std::string key)
+	{
+		if (!key.empty() && keys.empty())
+		{
+			keys.resize(commands.size());
+		}
+
+		commands.push_back(std::move(command));
+		if (!keys.empty())
+		{
+			keys.push_back(std::move(key));
+		}
+	}
+
+	// Removes a command the given one replaces, returns true if there was one
+	bool Coalesce(std::string_view key, std::string_view command, bool identical)
+	{
+		if (key.empty() && !identical)
+			return false;
+
+		for (size_t i = 0; i < commands.size(); ++i)
+		{
+			if (Coalesces(key, command, i < keys.size() ? keys[i] : std::string_view(), commands[i], identical))
+			{
+				commands.erase(commands.begin() + i);
+				if (!keys.empty())
+				{
+					keys.erase(keys.begin() + i);
+				}
+				return true;
+			}
+		}
+
+		return false;
+	}
+};
+
+class Channel;
+
+// Outcome of a command sent to several receivers at once, see Channel::SendCommand
+struct MultiSendReport
+{
+	enum class Result : uint8_t { Pending, Succeeded, Failed, TimedOut };
+
+	std::string command;
+	std::vector<std::string> recipients;
+	std::vector<Result> results; // by recipient
+
+	size_t Count(Result result) const { return std::count(results.begin(), results.end(), result); }
+};
+
+using MultiSendCallback = std::function<void(const MultiSendReport&)>;
+
+// A send held back by its lane's send limit, see Channel::ReleaseThrottled
+struct ThrottledSend
+{
+	std::vector<std::string> receivers; // empty for broadcasts
+	std::string command;
+	std::string key;
+	bool includeSelf = false;
+	bool multi = false;
+	MultiSendCallback onComplete;
+	int64_t executeAt = 0;
+	std::string topic;
+};
+
+// A multi-recipient send waiting on its replies. Reply callbacks hold a weak reference to it.
+struct MultiSend
+{
+	Channel* channel = nullptr;
+	std::chrono::steady_clock::time_point sentAt;
+	int64_t sentTime = 0;
+	size_t pending = 0;
+	MultiSendReport report;
+	MultiSendCallback onComplete;
+};
+
+// Delivery of personal commands to one receiver on a channel. Reply callbacks hold a weak
+// reference to it, so replies arriving after the channel is gone are ignored.
+struct ReceiverState
+{
+	struct InFlight
+	{
+		uint32_t sequence;
+		std::chrono::steady_clock::time_point sentAt; // when retrying, the time of the next attempt
+		int64_t sentTime; // wall clock, for clock offset samples
+		std::chrono::steady_clock::time_point firstSentAt;
+		std::string payload; // kept to retry, empty if retrying is off
+	};
+
+	Channel* channel = nullptr;
+	std::string name;
+	std::vector<InFlight> inFlight;
+	std::deque<InFlight> retrying; // failed while the receiver was away, sent again before anything else
+	std::deque<PendingBatch> waiting;
+	uint32_t nextSequence = 0;
+
+	uint64_t acked = 0;
+	uint64_t retried = 0;
+	uint64_t failed = 0;
+	uint64_t timedOut = 0;
+	uint64_t dropped = 0;
+	LatencyHistogram latency; // post until Success reply
+};
+
+inline bool IsLocalCharacter(std::string_view name)
+{
+	return pLocalPlayer && mq::ci_equals(name, pLocalPlayer->Name);
+}
 
 class Channel
 {
 public:
-	Channel(Logger* logger, std::string name, std::string_view sub_name = "");
+	Channel(const ChannelContext* context, ChannelHandle handle, std::string name, std::string_view sub_name = "");
 	~Channel();
 
-	void SendCommand(std::string command, bool includeSelf);
-	void SendCommand(std::string reciever, std::string command);
+	// Commands go out in the channel's default lane unless urgent is set. Sends over the lane's
+	// send limit are held back and go out in order as the limit allows, see ReleaseThrottled.
+	void SendCommand(std::string command, bool includeSelf, SendOptions options = {});
+	void SendCommand(std::string reciever, std::string command, SendOptions options = {});
+
+	// Encodes the command once and posts it to every receiver. Once each has replied, failed or
+	// timed out, onComplete gets the report. Without a callback the report is logged.
+	void SendCommand(std::vector<std::string> receivers, std::string command, MultiSendCallback onComplete = nullptr,
+		SendOptions options = {});
 
+	// Acknowledges a personal message
+	void PostSuccess(const std::shared_ptr<postoffice::Message>& message);
+
+	// Answers a personal message that was dropped, so the sender doesn't wait for it to time out
+	void PostRefused(const std::shared_ptr<postoffice::Message>& message);
+
+	// Posts a message that expects no reply to a character on this channel, outside of batching and flow
+	// control. An empty receiver broadcasts it.
+	void PostDirect(const std::string& receiver, proto::remote::Message& message);
+
+	// Called by the command queue once a received command runs
+	void RecordQueueTime(PeerInfo* peer, std::chrono::microseconds elapsed);
+
+	// Called by the command queue once a scheduled command runs, reports the run to its sender
+	void RecordExecution(const QueuedCommand& command);
+
+	// Called by the receive pipeline with a message it decoded
+	void OnReceived(ReceivedMessage& received);
+
+	// Delivers a captured message as if it was received, without replying. Its commands only run if run is set.
+	void Replay(const std::string& sender, std::string_view payload, bool run);
+
+	// Moves the channel to another sub name, such as a new group leader, keeping its state. The old
+	// mailbox keeps receiving until the ack timeout has passed, so messages and replies addressed
+	// to it while others catch up aren't lost.
+	void Rebind(std::string_view sub_name);
+
+	// Flushes batches, releases throttled sends and expires personal posts that never got a reply
+	void OnPulse();
+
+	// Posts buffered commands once the flush interval has passed, or right away if force is set
+	void Flush(bool force = false);
+
+	ChannelHandle GetHandle() const { return m_handle; }
 	std::string_view GetName() const { return m_name; }
 	std::string_view GetSubName() const { return m_sub_name; }
 	std::string_view GetDnsName() const { return m_dnsName;}
+	const ChannelStats& GetStats() const { return m_stats; }
+	const ChannelTraffic& GetTraffic() const { return m_traffic; }
+
+	void SetDefaultLane(Lane lane) { m_defaultLane = lane; }
+	Lane GetDefaultLane() const { return m_defaultLane; }
+	size_t GetThrottledDepth(Lane lane) const { return m_throttled[static_cast<size_t>(lane)].size(); }
+
+	// Members present on the channel, counting ourselves
+	size_t GetMemberCount() const { return m_memberCount + 1; }
+	bool IsMember(std::string_view name) const;
+
+	// True if the character announced itself on this channel and has since left or gone quiet.
+	// Characters never heard from, or running a version without presence, aren't known to be absent.
+	bool IsKnownAbsent(std::string_view name) const;
+
+	template <typename Func>
+	void ForEachMember(Func&& func) const
+	{
+		for (const auto& [name, peer] : m_peers)
+		{
+			if (peer->present)
+			{
+				func(name);
+			}
+		}
+	}
+
+	// Returns what is known about a character seen on this channel, null if it never was
+	const PeerInfo* FindPeer(std::string_view name) const
+	{
+		auto it = m_peers.find(name);
+		return it != m_peers.end() ? it->second.get() : nullptr;
+	}
+
+	template <typename Func>
+	void ForEachPeer(Func&& func) const
+	{
+		for (const auto& [name, peer] : m_peers)
+		{
+			func(name, *peer);
+		}
+	}
+
+	template <typename Func>
+	void ForEachReceiver(Func&& func) const
+	{
+		for (const auto& [_, receiver] : m_receivers)
+		{
+			func(*receiver);
+		}
+	}
 
 	// non-copyable
 	Channel(const Channel&) = delete;
 	Channel& operator=(const Channel&) = delete;
 
 private:
+	void SendBroadcast(std::string command, bool includeSelf, Lane lane, std::string key, int64_t executeAt,
+		std::string topic);
+	void SendPersonal(std::string receiver, std::string command, Lane lane, std::string key, int64_t executeAt);
+	void SendMulti(std::vector<std::string> receivers, std::string command, MultiSendCallback onComplete, Lane lane,
+		std::string key, int64_t executeAt);
+	void QueueLocal(std::string command, Lane lane, std::string key, int64_t executeAt);
+	bool AdmitSend(Lane lane);
+	void HoldSend(Lane lane, ThrottledSend&& send);
+	void ReleaseThrottled();
+	bool AdmitReceived(const proto::remote::Message& msg, const std::string& sender, PeerInfo& peer);
+	void AddToBatch(std::string receiver, std::string command, bool includeSelf, Lane lane, std::string key,
+		int64_t executeAt, std::string topic);
+	void PostBatch(PendingBatch& batch);
+	void BuildMessage(PendingBatch& batch, proto::remote::Message& message, bool compress);
+	void PostPersonal(const std::shared_ptr<ReceiverState>& receiver, PendingBatch& batch);
+	void PostPersonalPayload(const std::shared_ptr<ReceiverState>& receiver, const std::string& payload, uint32_t sequence);
+	void RetryPersonal();
+	void OnPersonalReply(ReceiverState& receiver, uint32_t sequence, int code, const std::shared_ptr<postoffice::Message>& reply);
+	void ReleaseWaiting(const std::shared_ptr<ReceiverState>& receiver);
+	void OnMultiReply(MultiSend& send, size_t index, int code, const std::shared_ptr<postoffice::Message>& reply);
+	void CompleteMultiSend(MultiSend& send);
+	void CountSent(size_t bytes, size_t posts = 1);
+	void ExpirePersonal();
+	void Announce(proto::remote::MessageId id);
+	void UpdatePresence(PeerInfo& peer, proto::remote::MessageId id);
+	void SetPresent(PeerInfo& peer, bool present);
+	void ExpireMembers();
+	void ResetMembers();
+	bool CanCompressFor(const std::string& receiver) const;
+	bool CanCompressFor(const std::vector<std::string>& receivers) const;
+	std::shared_ptr<PeerInfo>& UpdatePeer(const std::string& name, const proto::remote::Message& msg);
+	void RecordDelivery(PeerInfo& peer, const std::string& name, const proto::remote::Message& msg);
+	void QueueReceived(const proto::remote::Message& msg, const std::string* sender,
+		const std::shared_ptr<PeerInfo>& peer, const std::shared_ptr<postoffice::Message>& replyTo, bool dryRun = false);
+	postoffice::DropboxAPI AddActor();
+	void RemovePreviousActor();
 	void ReceivedMessageHandler(const std::shared_ptr<postoffice::Message>& message);
+	friend class Multiplexer; // delivers to ReceivedMessageHandler
+	void Dispatch(const std::shared_ptr<postoffice::Message>& message, const proto::remote::Message& msg);
+	void HandleMessage(const std::shared_ptr<postoffice::Message>& message, const proto::remote::Message& msg,
+		const std::shared_ptr<PeerInfo>& peer);
 
+	const ChannelContext* m_context;
 	Logger* m_logger; // pointer to the global logger
+	const ChannelHandle m_handle;
 	const std::string m_name;
-	const std::string m_sub_name;
-	const std::string m_dnsName;
+	std::string m_sub_name;
+	std::string m_dnsName;
+	uint32_t m_channelId = 0; // GetChannelId of m_dnsName, sent with every message while multiplexed
 	postoffice::DropboxAPI m_dropbox;
+
+	// mailbox from before the last rebind, removed once nothing is expected on it
+	postoffice::DropboxAPI m_previousDropbox;
+	std::string m_previousDnsName;
+	std::chrono::steady_clock::time_point m_previousUntil;
+
+	std::vector<PendingBatch> m_pending;
+	std::chrono::steady_clock::time_point m_flushAt;
+	ChannelStats m_stats;
+	ChannelTraffic m_traffic;
+	uint32_t m_broadcastSequence = 0;
+	std::unordered_map<std::string, std::shared_ptr<PeerInfo>, NameHash, NameEqual> m_peers;
+	std::unordered_map<std::string, std::shared_ptr<ReceiverState>, NameHash, NameEqual> m_receivers;
+	std::vector<std::shared_ptr<MultiSend>> m_multiSends;
+	size_t m_memberCount = 0; // peers with present set
+	std::chrono::steady_clock::time_point m_nextHeartbeat;
+	std::chrono::steady_clock::time_point m_nextModeAnnounce; // presence copy for the other Multiplex setting
+	std::unordered_set<std::string, NameHash, NameEqual> m_modeMismatches; // warned about, see Dispatch
+
+	Lane m_defaultLane = Lane::Bulk;
+	std::array<TokenBucket, LANE_COUNT> m_sendBuckets;
+	std::array<std::deque<ThrottledSend>, LANE_COUNT> m_throttled;
+
+	// reused for every delivery decoded on the game thread so steady state decoding doesn't allocate
+	proto::remote::Message m_received;
+
+	// messages in the receive pipeline hold a weak reference, so they are dropped once the channel is gone
+	std::shared_ptr<Channel*> m_lifetime = std::make_shared<Channel*>(this);
 };
 
 } // namespace remote
@@ -1,12 +1,26 @@
 
 #include "ChannelManager.h"
+#include "CommandArgs.h"
 #include "Logger.h"
+#include "Settings.h"
 
 #include <mq/Plugin.h>
 
 namespace remote {
 
-static constexpr std::chrono::milliseconds GROUP_UPDATE_INTERVAL(1000);
+// how long a group or raid channel survives without a leader before it is closed
+static constexpr std::chrono::milliseconds LEADER_LOST_DELAY(2000);
+
+// how long after logging in or zoning the first message is waited for
+static constexpr std::chrono::seconds READY_TIMEOUT(30);
+
+// topic subscriptions are saved with a prefix so an autojoin key says what it is
+static constexpr std::string_view TOPIC_KEY_PREFIX = "topic:";
+
+static std::string GetTopicKey(std::string_view topic)
+{
+	return fmt::format("{}{}", TOPIC_KEY_PREFIX, topic);
+}
 
 static std::string_view GetClassName()
 {
@@ -39,36 +53,318 @@ static std::string_view GetRaidLeaderName()
 	return {};
 }
 
+ChannelManager::ChannelManager(Logger* logger, Settings* settings)
+	: m_settings(settings)
+	, m_commands(&m_context.commandQueue)
+	, m_scheduler(&m_commands)
+	, m_observers(&m_observerOptions)
+	, m_logger(logger)
+{
+	m_context.logger = logger;
+	m_context.commands = &m_commands;
+	m_context.scheduler = &m_scheduler;
+	m_context.pipeline = &m_pipeline;
+	m_context.clocks = &m_clocks;
+	m_context.capture = &m_capture;
+	m_context.observers = &m_observers;
+	m_context.topics = &m_topics;
+	m_context.multiplexer = &m_multiplexer;
+
+	// built-in channels are interned in handle order
+	for (std::string_view name : { "global", "server", "group", "raid", "zone", "topic" })
+	{
+		Intern(name);
+	}
+}
+
+ChannelHandle ChannelManager::Intern(std::string_view name)
+{
+	if (auto it = m_handles.find(name); it != m_handles.end())
+	{
+		return it->second;
+	}
+
+	auto handle = static_cast<ChannelHandle>(m_names.size());
+	m_names.push_back(mq::to_lower_copy(name));
+	m_handles.emplace(m_names.back(), handle);
+	m_channels.resize(m_names.size());
+	m_suspended.resize(m_names.size());
+
+	return handle;
+}
+
+ChannelHandle ChannelManager::FindHandle(std::string_view name) const
+{
+	auto it = m_handles.find(name);
+	return it != m_handles.end() ? it->second : ChannelHandle::Invalid;
+}
+
+Channel& ChannelManager::OpenChannel(ChannelHandle handle, std::string_view sub_name)
+{
+	std::unique_ptr<Channel>& slot = m_channels[static_cast<size_t>(handle)];
+	slot.reset(); // the old actor is removed before its replacement is added
+
+	if (handle >= ChannelHandle::FirstCustom)
+	{
+		slot = std::make_unique<Channel>(&m_context, handle, "custom", GetChannelName(handle));
+	}
+	else
+	{
+		slot = std::make_unique<Channel>(&m_context, handle, std::string(GetChannelName(handle)), sub_name);
+	}
+
+	const bool urgent = std::any_of(m_urgentChannels.begin(), m_urgentChannels.end(),
+		[&](const std::string& name) { return ci_equals(name, GetChannelName(handle)); });
+	slot->SetDefaultLane(urgent ? Lane::Urgent : Lane::Bulk);
+
+	m_suspended[static_cast<size_t>(handle)] = false;
+	++m_generation;
+
+	if (m_readyTimer && !m_readyTimer->open)
+	{
+		m_readyTimer->opened.push_back(handle);
+	}
+
+	return *slot;
+}
+
+void ChannelManager::CloseChannel(ChannelHandle handle)
+{
+	m_channels[static_cast<size_t>(handle)].reset();
+	m_suspended[static_cast<size_t>(handle)] = false;
+	++m_generation;
+}
+
+void ChannelManager::SuspendChannel(ChannelHandle handle)
+{
+	if (GetChannel(handle))
+	{
+		CloseChannel(handle);
+		m_suspended[static_cast<size_t>(handle)] = true;
+	}
+}
+
+void ChannelManager::CloseCustomChannels()
+{
+	for (size_t i = static_cast<size_t>(ChannelHandle::FirstCustom); i < m_channels.size(); ++i)
+	{
+		SuspendChannel(static_cast<ChannelHandle>(i));
+	}
+}
+
+void ChannelManager::HoldCommand(ChannelHandle handle, std::vector<std::string> receivers, std::string command, bool includeSelf,
+	SendOptions options)
+{
+	if (m_outbox.size() >= m_outboxCapacity)
+	{
+		++m_outboxDropped;
+		if (m_outbox.empty())
+			return;
+
+		m_outbox.pop_front();
+	}
+
+	m_logger->Log(Logger::LogFlags::LOG_SEND, PLUGIN_MSG "\a-t[ \ax\at-->\ax\a-t(%s) ]\ax \aw%s\ax \a-t(held)\ax",
+		m_names[static_cast<size_t>(handle)], command);
+
+	m_outbox.push_back({ handle, std::move(receivers), std::move(command), includeSelf, std::move(options), std::chrono::steady_clock::now() });
+	++m_outboxHeld;
+}
+
+void ChannelManager::FlushOutbox()
+{
+	const auto expired = std::chrono::steady_clock::now() - m_outboxTTL;
+
+	// commands for a channel that is still away keep their place, so each channel's commands stay in order
+	for (auto it = m_outbox.begin(); it != m_outbox.end();)
+	{
+		Channel* channel = GetChannel(it->handle);
+		if (!channel)
+		{
+			if (IsSuspended(it->handle) && it->heldAt >= expired)
+			{
+				++it;
+			}
+			else
+			{
+				++m_outboxDropped;
+				it = m_outbox.erase(it);
+			}
+			continue;
+		}
+
+		if (it->receivers.empty())
+		{
+			channel->SendCommand(std::move(it->command), it->includeSelf, std::move(it->options));
+		}
+		else if (it->receivers.size() == 1)
+		{
+			channel->SendCommand(std::move(it->receivers.front()), std::move(it->command), std::move(it->options));
+		}
+		else
+		{
+			channel->SendCommand(std::move(it->receivers), std::move(it->command), nullptr, std::move(it->options));
+		}
+
+		it = m_outbox.erase(it);
+	}
+}
+
+void ChannelManager::RemoveChannel(ChannelHandle handle)
+{
+	if (static_cast<size_t>(handle) < m_channels.size())
+	{
+		CloseChannel(handle);
+	}
+}
+
 void ChannelManager::Initialize()
 {
-	m_global_channel.emplace(m_logger, "global");
+	LoadOptions();
+
+	if (m_decodeThread)
+	{
+		m_pipeline.Start(m_decodeQueueSize);
+	}
+
+	if (m_captureEnabled)
+	{
+		StartCapture();
+	}
+
+	m_multiplexer.Start(m_multiplex);
+	OpenChannel(ChannelHandle::Global);
 
 	if (GetGameState() == GAMESTATE_INGAME)
 	{
 		std::string_view server = GetServerShortName();
 		if (!server.empty())
 		{
-			m_server_channel.emplace(m_logger, "server", server);
+			OpenChannel(ChannelHandle::Server, server);
 		}
 
 		std::string_view shortName = pZoneInfo->ShortName;
 		if (!shortName.empty())
 		{
-			m_zone_channel.emplace(m_logger, "zone", shortName);
+			OpenChannel(ChannelHandle::Zone, shortName);
 		}
 
 		LoadPersistentChannels();
 	}
 }
 
+// A burst of 0 allows a second's worth of commands
+static RateLimit ReadRateLimit(const Settings& settings, const char* rateKey, const char* burstKey, int rate, int burst)
+{
+	RateLimit limit;
+	limit.rate = std::max(settings.GetInt("MQRemote", rateKey, rate), 0);
+	limit.burst = std::max(settings.GetInt("MQRemote", burstKey, burst), 0);
+	if (limit.burst <= 0)
+	{
+		limit.burst = limit.rate;
+	}
+
+	return limit;
+}
+
+void ChannelManager::LoadOptions()
+{
+	BatchOptions& batch = m_context.batch;
+	batch.enabled = m_settings->GetBool("MQRemote", "BatchCommands", false);
+	batch.flushInterval = std::chrono::milliseconds(
+		std::max(m_settings->GetInt("MQRemote", "BatchInterval", 0), 0));
+	batch.maxSize = std::max(m_settings->GetInt("MQRemote", "BatchMaxSize", 16), 1);
+
+	PersonalOptions& personal = m_context.personal;
+	personal.ackWindow = std::max(m_settings->GetInt("MQRemote", "AckWindow", 16), 1);
+	personal.ackTimeout = std::chrono::milliseconds(
+		std::max(m_settings->GetInt("MQRemote", "AckTimeout", 5000), 100));
+	personal.maxWaiting = std::max(m_settings->GetInt("MQRemote", "AckBacklog", 256), 0);
+
+	m_context.compression = m_settings->GetBool("MQRemote", "Compression", true);
+
+	CommandQueueOptions& commandQueue = m_context.commandQueue;
+	commandQueue.capacity = std::max(m_settings->GetInt("MQRemote", "CommandQueueSize", 256), 1);
+	commandQueue.budget = std::chrono::microseconds(
+		std::max(m_settings->GetInt("MQRemote", "CommandBudget", 2000), 0));
+	commandQueue.ackAfterRun = m_settings->GetBool("MQRemote", "AckAfterRun", false);
+	commandQueue.coalesceIdentical = m_settings->GetBool("MQRemote", "CoalesceIdentical", false);
+
+	std::string overflow = m_settings->GetString("MQRemote", "CommandOverflow", "oldest");
+	if (ci_equals(overflow, "newest"))
+	{
+		commandQueue.overflow = OverflowPolicy::DropNewest;
+	}
+	else if (ci_equals(overflow, "inline"))
+	{
+		commandQueue.overflow = OverflowPolicy::RunInline;
+	}
+	else
+	{
+		commandQueue.overflow = OverflowPolicy::DropOldest;
+	}
+
+	m_outboxCapacity = std::max(m_settings->GetInt("MQRemote", "OutboxSize", 64), 0);
+	m_outboxTTL = std::chrono::milliseconds(std::max(m_settings->GetInt("MQRemote", "OutboxTTL", 30000), 0));
+	m_context.personal.forwardTTL = std::chrono::milliseconds(
+		std::max(m_settings->GetInt("MQRemote", "ForwardTTL", 10000), 0));
+
+	LaneOptions& lanes = m_context.lanes;
+	lanes.send[static_cast<size_t>(Lane::Urgent)] = ReadRateLimit(*m_settings, "UrgentSendRate", "UrgentSendBurst", 0, 0);
+	lanes.send[static_cast<size_t>(Lane::Bulk)] = ReadRateLimit(*m_settings, "BulkSendRate", "BulkSendBurst", 0, 0);
+	lanes.receive[static_cast<size_t>(Lane::Urgent)] = ReadRateLimit(*m_settings, "UrgentReceiveRate", "UrgentReceiveBurst", 0, 0);
+	lanes.receive[static_cast<size_t>(Lane::Bulk)] = ReadRateLimit(*m_settings, "BulkReceiveRate", "BulkReceiveBurst", 0, 0);
+	lanes.sendBacklog = std::max(m_settings->GetInt("MQRemote", "SendBacklog", 256), 0);
+
+	m_urgentChannels.clear();
+	std::string urgentChannels = m_settings->GetString("MQRemote", "UrgentChannels", "");
+	ForEachReceiver(urgentChannels, [&](std::string_view name) {
+		name = trim(name);
+		if (!name.empty())
+		{
+			m_urgentChannels.emplace_back(name);
+		}
+	});
+
+	PresenceOptions& presence = m_context.presence;
+	presence.interval = std::chrono::milliseconds(
+		std::max(m_settings->GetInt("MQRemote", "PresenceInterval", 5000), 0));
+	presence.timeout = std::chrono::milliseconds(
+		std::max(m_settings->GetInt("MQRemote", "PresenceTimeout", 15000), 1000));
+
+	m_observerOptions.interval = std::chrono::milliseconds(
+		std::max(m_settings->GetInt("MQRemote", "ObserveInterval", 250), 0));
+	m_observerOptions.lease = std::chrono::milliseconds(
+		std::max(m_settings->GetInt("MQRemote", "ObserveLease", 10000), 1000));
+
+	m_decodeThread = m_settings->GetBool("MQRemote", "DecodeThread", true);
+	m_decodeQueueSize = static_cast<size_t>(std::max(m_settings->GetInt("MQRemote", "DecodeQueueSize", 4096), 16));
+	m_multiplex = m_settings->GetBool("MQRemote", "Multiplex", false);
+
+	m_captureEnabled = m_settings->GetBool("MQRemote", "Capture", false);
+	m_captureFileSize = static_cast<size_t>(std::max(m_settings->GetInt("MQRemote", "CaptureFileSize", 64), 1)) * 1024 * 1024;
+	m_captureFiles = std::max(m_settings->GetInt("MQRemote", "CaptureFiles", 4), 1);
+}
+
+bool ChannelManager::StartCapture()
+{
+	return m_capture.Start(gPathLogs, m_captureFileSize, m_captureFiles);
+}
+
 void ChannelManager::Shutdown()
 {
-	m_global_channel.reset();
-	m_server_channel.reset();
-	m_group_channel.reset();
-	m_raid_channel.reset();
-	m_zone_channel.reset();
-	m_custom_channels.clear();
+	// channels are closing, whatever is still being decoded for them is dropped
+	m_pipeline.Stop();
+	m_replay.Stop();
+	m_observers.ForgetAll(*this);
+
+	for (std::unique_ptr<Channel>& channel : m_channels)
+	{
+		channel.reset();
+	}
+
+	m_multiplexer.Stop();
+	m_capture.Stop();
 }
 
 void ChannelManager::JoinCustomChannel(std::string_view nameArg, std::string_view autoArg)
@@ -92,18 +388,48 @@ void ChannelManager::JoinCustomChannel(std::string_view nameArg, std::string_vie
 		return;
 	}
 
-	std::string name = mq::to_lower_copy(nameArg);
-	auto [_, inserted] = m_custom_channels.try_emplace(name, m_logger, "custom", name);
-	if (!inserted)
+	// /rc looks channels up by a copy in a fixed buffer, a longer name could never be sent to
+	if (nameArg.size() > RemoteCommandArgs::MAX_CHANNEL_LENGTH)
+	{
+		WriteChatf(PLUGIN_MSG "Channel names can't be longer than %d characters", static_cast<int>(RemoteCommandArgs::MAX_CHANNEL_LENGTH));
+		return;
+	}
+
+	// saved autojoin keys with the prefix are read back as topics
+	if (ci_starts_with(nameArg, TOPIC_KEY_PREFIX))
+	{
+		WriteChatf(PLUGIN_MSG "Channel names can't start with \ay%.*s\ax", static_cast<int>(TOPIC_KEY_PREFIX.size()), TOPIC_KEY_PREFIX.data());
+		return;
+	}
+
+	if (IsTopicName(nameArg))
+	{
+		JoinTopic(nameArg, auto_join);
+		return;
+	}
+
+	ChannelHandle handle = Intern(nameArg);
+	if (handle < ChannelHandle::FirstCustom)
+	{
+		WriteChatf(PLUGIN_MSG "\aw%.*s\ax is a built-in channel", static_cast<int>(nameArg.size()), nameArg.data());
+		return;
+	}
+
+	const std::string& name = m_names[static_cast<size_t>(handle)];
+	if (GetChannel(handle))
 	{
 		WriteChatf(PLUGIN_MSG "Already joined channel %s", name.c_str());
 	}
+	else
+	{
+		OpenChannel(handle);
+	}
 	
 	if (auto_join)
 	{
 		if (!m_channelINISection.empty())
 		{
-			WritePrivateProfileBool(m_channelINISection, name, true, INIFileName);
+			m_settings->SetBool(m_channelINISection, name, true);
 			WriteChatf(PLUGIN_MSG "Enable autojoin for: \aw%s\ax", name.c_str());
 		}
 		else
@@ -134,11 +460,26 @@ void ChannelManager::LeaveCustomChannel(std::string_view nameArg, std::string_vi
 		return;
 	}
 
-	std::string name = mq::to_lower_copy(nameArg);
-	if (auto it = m_custom_channels.find(name); it != m_custom_channels.end())
+	if (IsTopicName(nameArg))
+	{
+		LeaveTopic(nameArg, auto_join);
+		return;
+	}
+
+	ChannelHandle handle = FindHandle(nameArg);
+	if (handle < ChannelHandle::FirstCustom)
+	{
+		WriteChatf(PLUGIN_MSG "\aw%.*s\ax is a built-in channel", static_cast<int>(nameArg.size()), nameArg.data());
+		return;
+	}
+
+	// a channel that was never joined this session has no interned name yet
+	const std::string name = handle != ChannelHandle::Invalid
+		? m_names[static_cast<size_t>(handle)] : mq::to_lower_copy(nameArg);
+	if (Channel* channel = GetChannel(handle))
 	{
-		std::string dns_name = std::string(it->second.GetDnsName());  // store value before erasing
-		m_custom_channels.erase(it);
+		std::string dns_name = std::string(channel->GetDnsName());  // store value before closing
+		CloseChannel(handle);
 
 		WriteChatf(PLUGIN_MSG "Left channel: \aw%s\ax", dns_name.c_str());
 	}
@@ -147,9 +488,9 @@ void ChannelManager::LeaveCustomChannel(std::string_view nameArg, std::string_vi
 	{
 		if (!m_channelINISection.empty()) 
 		{
-			if (PrivateProfileKeyExists(m_channelINISection, name, INIFileName))
+			if (m_settings->HasKey(m_channelINISection, name))
 			{
-				DeletePrivateProfileKey(m_channelINISection, name, INIFileName);
+				m_settings->DeleteKey(m_channelINISection, name);
 				
 				WriteChatf(PLUGIN_MSG "Disable autojoin for: \aw%s\ax", name.c_str());
 			}
@@ -161,40 +502,91 @@ void ChannelManager::LeaveCustomChannel(std::string_view nameArg, std::string_vi
 	}
 }
 
-remote::Channel* ChannelManager::FindChannel(std::string_view name)
+void ChannelManager::JoinTopic(std::string_view pattern, bool autoJoin)
 {
-	if (m_global_channel && m_global_channel->GetName() == name) 
+	const std::string name = mq::to_lower_copy(pattern);
+	if (!TopicTrie::IsValid(name))
 	{
-		return &*m_global_channel;
+		WriteChatf(PLUGIN_MSG "\ar%s\ax is not a valid topic, use dotted names with * for any one level, e.g. \awraid2.*\ax or \aw*.clr\ax", name.c_str());
+		return;
 	}
-	
-	if (m_server_channel && m_server_channel->GetName() == name) 
+
+	if (m_topics.Add(name))
+	{
+		++m_generation;
+		WriteChatf(PLUGIN_MSG "Subscribed to topic: \aw%s\ax", name.c_str());
+	}
+	else
 	{
-		return &*m_server_channel;
+		WriteChatf(PLUGIN_MSG "Already subscribed to topic %s", name.c_str());
 	}
 
-	if (m_group_channel && m_group_channel->GetName() == name) 
+	if (!GetTopicChannel())
 	{
-		return &*m_group_channel;
+		OpenChannel(ChannelHandle::Topic);
 	}
 
-	if (m_raid_channel && m_raid_channel->GetName() == name) 
+	if (autoJoin)
 	{
-		return &*m_raid_channel;
+		if (!m_channelINISection.empty())
+		{
+			m_settings->SetBool(m_channelINISection, GetTopicKey(name), true);
+			WriteChatf(PLUGIN_MSG "Enable autojoin for: \aw%s\ax", name.c_str());
+		}
+		else
+		{
+			WriteChatf(PLUGIN_MSG "Autojoin toggle is only available while being ingame.");
+		}
 	}
+}
 
-	if (m_zone_channel && m_zone_channel->GetName() == name) 
+void ChannelManager::LeaveTopic(std::string_view pattern, bool autoJoin)
+{
+	// the topic channel stays open, it is still needed to publish
+	const std::string name = mq::to_lower_copy(pattern);
+	if (m_topics.Remove(name))
 	{
-		return &*m_zone_channel;
+		++m_generation;
+		WriteChatf(PLUGIN_MSG "Unsubscribed from topic: \aw%s\ax", name.c_str());
 	}
 
-	auto it = m_custom_channels.find(std::string(name));
-	if (it != m_custom_channels.end())
+	if (!autoJoin)
 	{
-		return &it->second;
+		if (!m_channelINISection.empty())
+		{
+			const std::string key = GetTopicKey(name);
+			if (m_settings->HasKey(m_channelINISection, key))
+			{
+				m_settings->DeleteKey(m_channelINISection, key);
+
+				WriteChatf(PLUGIN_MSG "Disable autojoin for: \aw%s\ax", name.c_str());
+			}
+		}
+		else
+		{
+			WriteChatf(PLUGIN_MSG "Autojoin toggle is only available while being ingame.");
+		}
+	}
+}
+
+void ChannelManager::SendTopic(std::string_view topic, std::string command, bool includeSelf, SendOptions options)
+{
+	options.topic = mq::to_lower_copy(topic);
+
+	Channel* channel = GetTopicChannel();
+	if (!channel && IsSuspended(ChannelHandle::Topic))
+	{
+		HoldCommand(ChannelHandle::Topic, {}, std::move(command), includeSelf, std::move(options));
+		return;
+	}
+
+	// publishing doesn't need a subscription, the channel is opened on first use
+	if (!channel)
+	{
+		channel = &OpenChannel(ChannelHandle::Topic);
 	}
 
-	return nullptr;
+	channel->SendCommand(std::move(command), includeSelf, std::move(options));
 }
 
 void ChannelManager::LoadPersistentChannels()
@@ -202,67 +594,126 @@ void ChannelManager::LoadPersistentChannels()
 	if (m_channelINISection.empty())
 		return;
 
-	std::vector<std::string> channels = GetPrivateProfileKeys(m_channelINISection, INIFileName);
+	std::vector<std::string> channels = m_settings->GetKeys(m_channelINISection);
 	for (const std::string& channel : channels)
 	{
-		if (GetPrivateProfileBool(m_channelINISection, channel.c_str(), false, INIFileName))
+		if (m_settings->GetBool(m_channelINISection, channel, false))
 		{
-			m_custom_channels.try_emplace(channel, m_logger, "custom", channel);
+			const bool prefixed = ci_starts_with(channel, TOPIC_KEY_PREFIX);
+			if (!prefixed && !IsTopicName(channel))
+			{
+				ChannelHandle handle = Intern(channel);
+				if (handle >= ChannelHandle::FirstCustom && !GetChannel(handle))
+				{
+					OpenChannel(handle);
+				}
+				continue;
+			}
+
+			const std::string topic = mq::to_lower_copy(prefixed ? std::string_view(channel).substr(TOPIC_KEY_PREFIX.size()) : std::string_view(channel));
+			if (!TopicTrie::IsValid(topic))
+			{
+				WriteChatf(PLUGIN_MSG "\arSkipping autojoin key %s\ax, it is not a valid topic", channel.c_str());
+				continue;
+			}
+
+			if (!prefixed)
+			{
+				// saved before topics existed, /rc now publishes a dotted name as a topic so the old
+				// custom channel could no longer be sent to. Keep it as a subscription to that topic.
+				m_settings->DeleteKey(m_channelINISection, channel);
+				m_settings->SetBool(m_channelINISection, GetTopicKey(topic), true);
+				WriteChatf(PLUGIN_MSG "Autojoin channel \aw%s\ax is now a topic subscription, clients that haven't been updated can't send to it", topic.c_str());
+			}
+
+			if (m_topics.Add(topic))
+			{
+				++m_generation;
+			}
 		}
 	}
+
+	if (!m_topics.IsEmpty() && !GetTopicChannel())
+	{
+		OpenChannel(ChannelHandle::Topic);
+	}
 }
 
-void ChannelManager::UpdateGroupChannel()
+void ChannelManager::UpdateLeaderChannel(ChannelHandle handle, std::string_view leaderName,
+	std::optional<std::chrono::steady_clock::time_point>& lostAt)
 {
-	std::string_view leaderName = GetGroupLeaderName();
+	Channel* channel = GetChannel(handle);
 	if (!leaderName.empty())
 	{
-		if (!m_group_channel || !ci_equals(m_group_channel->GetSubName(), leaderName))
+		lostAt.reset();
+
+		if (!channel)
 		{
-			m_group_channel.emplace(m_logger, "group", leaderName);
+			OpenChannel(handle, leaderName);
+		}
+		else if (!ci_equals(channel->GetSubName(), leaderName))
+		{
+			channel->Rebind(leaderName);
+			++m_generation;
 		}
 	}
-	else if (m_group_channel) 
+	else if (!channel)
 	{
-		m_group_channel.reset();
+		// not in a group or raid after coming back
+		m_suspended[static_cast<size_t>(handle)] = false;
 	}
-}
-
-void ChannelManager::UpdateRaidChannel()
-{
-	std::string_view leaderName = GetRaidLeaderName();
-	if (!leaderName.empty())
+	else
 	{
-		if (!m_raid_channel || !ci_equals(m_raid_channel->GetSubName(), leaderName))
+		// the leader briefly disappears while leadership is handed over
+		const auto now = std::chrono::steady_clock::now();
+		if (!lostAt)
 		{
-			m_raid_channel.emplace(m_logger, "raid", leaderName);
+			lostAt = now;
+		}
+		else if (now - *lostAt >= LEADER_LOST_DELAY)
+		{
+			lostAt.reset();
+			CloseChannel(handle);
 		}
 	}
-	else if (m_raid_channel)
-	{
-		m_raid_channel.reset();
-	}
+}
+
+void ChannelManager::UpdateGroupChannel()
+{
+	UpdateLeaderChannel(ChannelHandle::Group, GetGroupLeaderName(), m_groupLeaderLostAt);
+}
+
+void ChannelManager::UpdateRaidChannel()
+{
+	UpdateLeaderChannel(ChannelHandle::Raid, GetRaidLeaderName(), m_raidLeaderLostAt);
 }
 
 void ChannelManager::SetGameState(int gameState)
 {
 	if (gameState != GAMESTATE_INGAME)
 	{
-		m_server_channel.reset();
-		m_group_channel.reset();
-		m_raid_channel.reset();
-		m_zone_channel.reset();
-		m_custom_channels.clear();
+		SuspendChannel(ChannelHandle::Server);
+		SuspendChannel(ChannelHandle::Group);
+		SuspendChannel(ChannelHandle::Raid);
+		SuspendChannel(ChannelHandle::Zone);
+		SuspendChannel(ChannelHandle::Topic);
+		CloseCustomChannels();
+		m_topics.Clear(); // subscriptions belong to the character
 		m_channelINISection.clear();
 	}
 	else if (gameState > GAMESTATE_PRECHARSELECT)
 	{
-		if (!m_server_channel)
+		if (gameState == GAMESTATE_INGAME && m_channelINISection.empty())
+		{
+			StartReadyTimer(m_loginReady);
+		}
+
+		if (!GetServerChannel())
 		{
 			std::string_view server = GetServerShortName();
 			if (!server.empty())
 			{
-				m_server_channel.emplace(m_logger, "server", server);
+				OpenChannel(ChannelHandle::Server, server);
 			}
 		}
 	}
@@ -270,27 +721,62 @@ void ChannelManager::SetGameState(int gameState)
 
 void ChannelManager::OnPulse()
 {
-	if (GetGameState() == GAMESTATE_INGAME)
+	if (!m_outbox.empty())
 	{
-		auto now = std::chrono::steady_clock::now();
-		if (now > m_nextGroupUpdate)
+		FlushOutbox();
+	}
+
+	// messages decoded since the last pulse, for channels that are still open
+	m_pipeline.Drain([](ReceivedMessage& received) {
+		if (std::shared_ptr<Channel*> channel = received.channel.lock())
 		{
-			m_nextGroupUpdate = now + GROUP_UPDATE_INTERVAL;
-			UpdateGroupChannel();
-			UpdateRaidChannel();
+			(*channel)->OnReceived(received);
 		}
+	});
+
+	ForEachChannel([](Channel& channel) { channel.OnPulse(); });
+	m_replay.OnPulse(*this);
+	m_observers.OnPulse(*this, GetGameState() == GAMESTATE_INGAME);
+	m_scheduler.OnPulse();
+	m_commands.Drain();
+
+	if (m_readyTimer)
+	{
+		UpdateReadyTimer();
+	}
+
+	if (GetGameState() == GAMESTATE_INGAME)
+	{
+		// comparing the leader names is cheap enough to notice a change on the frame it happens
+		UpdateGroupChannel();
+		UpdateRaidChannel();
 
 		if (m_channelINISection.empty())
 		{
 			m_channelINISection = fmt::format("{}.{}", GetServerShortName(), pLocalPlayer->Name);
 			LoadPersistentChannels();
+
+			// commands held for the topic channel are published even without subscriptions
+			if (IsSuspended(ChannelHandle::Topic) && !GetTopicChannel())
+			{
+				OpenChannel(ChannelHandle::Topic);
+			}
+
+			MarkChannelsOpen();
+
+			// custom channels that weren't joined again aren't coming back
+			for (size_t i = static_cast<size_t>(ChannelHandle::FirstCustom); i < m_suspended.size(); ++i)
+			{
+				m_suspended[i] = false;
+			}
 		}
 	}
 }
 
 void ChannelManager::OnBeginZone()
 {
-	m_zone_channel.reset();
+	SuspendChannel(ChannelHandle::Zone);
+	StartReadyTimer(m_zoneReady);
 }
 
 void ChannelManager::OnEndZone()
@@ -300,9 +786,68 @@ void ChannelManager::OnEndZone()
 		std::string_view shortName = pZoneInfo->ShortName;
 		if (!shortName.empty())
 		{
-			m_zone_channel.emplace(m_logger, "zone", shortName);
+			OpenChannel(ChannelHandle::Zone, shortName);
+		}
+
+		MarkChannelsOpen();
+	}
+
+	FlushOutbox();
+}
+
+void ChannelManager::StartReadyTimer(ReadyStats& stats)
+{
+	m_readyTimer.emplace();
+	m_readyTimer->stats = &stats;
+	m_readyTimer->start = std::chrono::steady_clock::now();
+	m_readyTimer->registrations = m_multiplexer.GetRegistrations();
+}
+
+void ChannelManager::MarkChannelsOpen()
+{
+	if (!m_readyTimer || m_readyTimer->open)
+		return;
+
+	ReadyTimer& timer = *m_readyTimer;
+	timer.stats->open.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - timer.start));
+	timer.stats->lastRegistrations = m_multiplexer.GetRegistrations() - timer.registrations;
+	timer.open = true;
+	timer.received = CountReceived(timer.opened);
+}
+
+uint64_t ChannelManager::CountReceived(const std::vector<ChannelHandle>& handles)
+{
+	uint64_t received = 0;
+	for (ChannelHandle handle : handles)
+	{
+		if (const Channel* channel = GetChannel(handle))
+		{
+			received += ChannelTraffic::Read(channel->GetTraffic().messagesIn);
 		}
 	}
+
+	return received;
+}
+
+void ChannelManager::UpdateReadyTimer()
+{
+	ReadyTimer& timer = *m_readyTimer;
+	if (!timer.open)
+		return;
+
+	const auto elapsed = std::chrono::steady_clock::now() - timer.start;
+	if (elapsed > READY_TIMEOUT || timer.opened.empty())
+	{
+		// nobody else is around to hear from
+		m_readyTimer.reset();
+		return;
+	}
+
+	if (CountReceived(timer.opened) > timer.received)
+	{
+		timer.stats->heard.Record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed));
+		m_readyTimer.reset();
+	}
 }
 
 } // namespace remote
@@ -1,22 +1,40 @@
 #pragma once
 
+#include "Capture.h"
 #include "Channel.h"
-
+#include "ClockSync.h"
+#include "Multiplexer.h"
+#include "NameHash.h"
+#include "Observers.h"
+#include "ReceivePipeline.h"
+#include "Scheduler.h"
+#include "TopicTrie.h"
+
+#include <deque>
+#include <memory>
 #include <optional>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 namespace remote {
 
 class Logger;
+class Settings;
+
+// Time from logging in or zoning until the channels are open again, and until the first message
+// arrives on one of them, which is about when the other clients can reach us
+struct ReadyStats
+{
+	LatencyHistogram open;
+	LatencyHistogram heard;
+	uint64_t lastRegistrations = 0; // postoffice registrations it took the last time
+};
 
 class ChannelManager
 {
 public:
-	ChannelManager(Logger* logger)
-		: m_logger(logger)
-	{
-	}
+	ChannelManager(Logger* logger, Settings* settings);
 
 	// lifecycle
 	void Initialize();
@@ -30,40 +48,174 @@ public:
 	// channels
 	void JoinCustomChannel(std::string_view name, std::string_view autoArg = {});
 	void LeaveCustomChannel(std::string_view name, std::string_view autoArg = {});
-	Channel* FindChannel(std::string_view name);
+	void RemoveChannel(ChannelHandle handle);
+
+	// topics, carried by the topic channel and filtered by the subscriptions in GetTopics
+	void SendTopic(std::string_view topic, std::string command, bool includeSelf, SendOptions options = {});
+	const TopicTrie& GetTopics() const { return m_topics; }
+
+	// Handles stay valid for the lifetime of the manager, even while their channel isn't joined
+	ChannelHandle FindHandle(std::string_view name) const;
+	std::string_view GetChannelName(ChannelHandle handle) const { return m_names[static_cast<size_t>(handle)]; }
+	size_t GetHandleCount() const { return m_names.size(); }
+
+	// Changes whenever a channel is opened, closed or rebound
+	uint32_t GetGeneration() const { return m_generation; }
+
+	Channel* GetChannel(ChannelHandle handle)
+	{
+		return static_cast<size_t>(handle) < m_channels.size() ? m_channels[static_cast<size_t>(handle)].get() : nullptr;
+	}
 
-	Channel* GetGlobalChannel() { return opt_ptr(m_global_channel); }
-	Channel* GetServerChannel() { return opt_ptr(m_server_channel); }
-	Channel* GetGroupChannel() { return opt_ptr(m_group_channel); }
-	Channel* GetRaidChannel() { return opt_ptr(m_raid_channel); }
-	Channel* GetZoneChannel() { return opt_ptr(m_zone_channel); }
+	Channel* FindChannel(std::string_view name) { return GetChannel(FindHandle(name)); }
 
-	std::unordered_map<std::string, Channel>& GetCustomChannels() { return m_custom_channels; }
+	Channel* GetGlobalChannel() { return GetChannel(ChannelHandle::Global); }
+	Channel* GetServerChannel() { return GetChannel(ChannelHandle::Server); }
+	Channel* GetGroupChannel() { return GetChannel(ChannelHandle::Group); }
+	Channel* GetRaidChannel() { return GetChannel(ChannelHandle::Raid); }
+	Channel* GetZoneChannel() { return GetChannel(ChannelHandle::Zone); }
+	Channel* GetTopicChannel() { return GetChannel(ChannelHandle::Topic); }
 
 	void LoadPersistentChannels();
 
-private:
-	static Channel* opt_ptr(std::optional<Channel>& o)
+	// True while the channel is closed by zoning or a game state change and expected back
+	bool IsSuspended(ChannelHandle handle) const
+	{
+		return static_cast<size_t>(handle) < m_suspended.size() && m_suspended[static_cast<size_t>(handle)];
+	}
+
+	// Holds a command for a suspended channel until it is open again or OutboxTTL has passed.
+	// receivers is empty for a broadcast.
+	void HoldCommand(ChannelHandle handle, std::vector<std::string> receivers, std::string command, bool includeSelf,
+		SendOptions options = {});
+
+	size_t GetOutboxDepth() const { return m_outbox.size(); }
+	uint64_t GetOutboxHeld() const { return m_outboxHeld; }
+	uint64_t GetOutboxDropped() const { return m_outboxDropped; }
+
+	// options
+	void LoadOptions();
+	const BatchOptions& GetBatchOptions() const { return m_context.batch; }
+	const CommandQueue& GetCommandQueue() const { return m_commands; }
+	const ClockSync& GetClockSync() const { return m_clocks; }
+	const Scheduler& GetScheduler() const { return m_scheduler; }
+	const ReceivePipeline& GetReceivePipeline() const { return m_pipeline; }
+	const Multiplexer& GetMultiplexer() const { return m_multiplexer; }
+	const ReadyStats& GetLoginStats() const { return m_loginReady; }
+	const ReadyStats& GetZoneStats() const { return m_zoneReady; }
+	Observers& GetObservers() { return m_observers; }
+	const Observers& GetObservers() const { return m_observers; }
+	const LaneOptions& GetLaneOptions() const { return m_context.lanes; }
+
+	// traffic capture and replay
+	bool StartCapture();
+	void StopCapture() { m_capture.Stop(); }
+	const TrafficCapture& GetCapture() const { return m_capture; }
+	bool StartReplay(const std::string& path, double speed, bool run) { return m_replay.Start(path, speed, run); }
+	void StopReplay() { m_replay.Stop(); }
+	const TrafficReplay& GetReplay() const { return m_replay; }
+
+	template <typename Func>
+	void ForEachChannel(Func&& func)
 	{
-		return o ? &*o : nullptr;
+		for (const std::unique_ptr<Channel>& channel : m_channels)
+		{
+			if (channel)
+			{
+				func(*channel);
+			}
+		}
 	}
 
+private:
+	ChannelHandle Intern(std::string_view name);
+	Channel& OpenChannel(ChannelHandle handle, std::string_view sub_name = {});
+	void CloseChannel(ChannelHandle handle);
+	void SuspendChannel(ChannelHandle handle);
+	void CloseCustomChannels();
+	void JoinTopic(std::string_view pattern, bool autoJoin);
+	void LeaveTopic(std::string_view pattern, bool autoJoin);
+	void FlushOutbox();
+
+	void StartReadyTimer(ReadyStats& stats);
+	void MarkChannelsOpen();
+	void UpdateReadyTimer();
+	uint64_t CountReceived(const std::vector<ChannelHandle>& handles);
+
 	void UpdateGroupChannel();
 	void UpdateRaidChannel();
+	void UpdateLeaderChannel(ChannelHandle handle, std::string_view leaderName,
+		std::optional<std::chrono::steady_clock::time_point>& lostAt);
 
 private:
+	Settings* m_settings;
 	std::string m_channelINISection;
-
-	std::optional<Channel> m_global_channel;
-	std::optional<Channel> m_server_channel;
-	std::optional<Channel> m_group_channel;
-	std::optional<Channel> m_raid_channel;
-	std::optional<Channel> m_zone_channel;
-
-	std::unordered_map<std::string, Channel> m_custom_channels;
+	ChannelContext m_context;
+	CommandQueue m_commands;
+	Scheduler m_scheduler;
+	ClockSync m_clocks;
+	TrafficCapture m_capture;
+	TrafficReplay m_replay;
+	ObserverOptions m_observerOptions;
+	Observers m_observers;
+	TopicTrie m_topics;
+
+	ReceivePipeline m_pipeline;
+	bool m_decodeThread = true;
+	size_t m_decodeQueueSize = 0;
+
+	// declared ahead of the channels, which detach from it when they close
+	Multiplexer m_multiplexer;
+	bool m_multiplex = false;
+
+	struct ReadyTimer
+	{
+		ReadyStats* stats = nullptr;
+		std::chrono::steady_clock::time_point start;
+		uint64_t registrations = 0; // at the start
+		std::vector<ChannelHandle> opened;
+		uint64_t received = 0;      // messages the opened channels had received once they were all open
+		bool open = false;
+	};
+	std::optional<ReadyTimer> m_readyTimer;
+	ReadyStats m_loginReady;
+	ReadyStats m_zoneReady;
+
+	bool m_captureEnabled = false;
+	size_t m_captureFileSize = 0;
+	int m_captureFiles = 0;
+
+	// channels that send in the urgent lane by default
+	std::vector<std::string> m_urgentChannels;
+
+	// interned names, indexed by handle. built-in channels occupy the first slots
+	std::vector<std::string> m_names;
+	uint32_t m_generation = 0;
+	std::unordered_map<std::string, ChannelHandle, NameHash, NameEqual> m_handles;
+
+	// open channels, indexed by handle
+	std::vector<std::unique_ptr<Channel>> m_channels;
+	std::vector<bool> m_suspended;
+
+	// commands sent to suspended channels
+	struct HeldCommand
+	{
+		ChannelHandle handle;
+		std::vector<std::string> receivers;
+		std::string command;
+		bool includeSelf;
+		SendOptions options;
+		std::chrono::steady_clock::time_point heldAt;
+	};
+	std::deque<HeldCommand> m_outbox;
+	size_t m_outboxCapacity = 0;
+	std::chrono::milliseconds m_outboxTTL{ 0 };
+	uint64_t m_outboxHeld = 0;
+	uint64_t m_outboxDropped = 0;
 
 	Logger* m_logger;
-	std::chrono::steady_clock::time_point m_nextGroupUpdate = std::chrono::steady_clock::now();
+	std::optional<std::chrono::steady_clock::time_point> m_groupLeaderLostAt;
+	std::optional<std::chrono::steady_clock::time_point> m_raidLeaderLostAt;
 };
 
 } // namespace remote
@@ -0,0 +1,48 @@
+#include "ClockSync.h"
+
+namespace remote {
+
+// an estimate is replaced regardless of round trip once it is this old
+static constexpr std::chrono::seconds ESTIMATE_MAX_AGE(60);
+
+void ClockSync::AddSample(std::string_view peer, int64_t sentAt, int64_t receivedAt, int64_t repliedAt)
+{
+	const int64_t roundTrip = repliedAt - sentAt;
+	if (roundTrip < 0)
+		return;
+
+	// assumes the request and the reply took equally long
+	const int64_t offset = receivedAt - (sentAt + roundTrip / 2);
+	const auto now = std::chrono::steady_clock::now();
+
+	auto it = m_estimates.find(peer);
+	if (it == m_estimates.end())
+	{
+		m_estimates.emplace(std::string(peer), Estimate{ offset, roundTrip, now });
+		return;
+	}
+
+	Estimate& estimate = it->second;
+	if (roundTrip <= estimate.roundTrip || now - estimate.updated > ESTIMATE_MAX_AGE)
+	{
+		estimate = Estimate{ offset, roundTrip, now };
+	}
+	else if (roundTrip <= estimate.roundTrip * 2)
+	{
+		// close enough to the best sample to smooth the estimate with
+		estimate.offset += (offset - estimate.offset) / 8;
+	}
+}
+
+int64_t ClockSync::GetOffset(std::string_view peer) const
+{
+	auto it = m_estimates.find(peer);
+	return it != m_estimates.end() ? it->second.offset : 0;
+}
+
+bool ClockSync::HasOffset(std::string_view peer) const
+{
+	return m_estimates.find(peer) != m_estimates.end();
+}
+
+} // namespace remote
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "NameHash.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace remote {
+
+// Wall clock time in microseconds since the epoch, as carried in messages
+inline int64_t WallClockMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Estimates how far each peer's wall clock is from ours, using request/reply pairs the way
+// NTP does. Samples with the shortest round trip are the most accurate, so a sample only
+// replaces the estimate if its round trip is close to the best one seen recently.
+class ClockSync
+{
+public:
+	// sentAt and repliedAt are our clock, receivedAt is the peer's clock
+	void AddSample(std::string_view peer, int64_t sentAt, int64_t receivedAt, int64_t repliedAt);
+
+	// Peer clock minus our clock in microseconds, 0 if the peer was never measured
+	int64_t GetOffset(std::string_view peer) const;
+	bool HasOffset(std::string_view peer) const;
+
+	// Converts a timestamp taken on the peer's clock into ours
+	int64_t ToLocal(std::string_view peer, int64_t peerTime) const { return peerTime - GetOffset(peer); }
+
+private:
+	struct Estimate
+	{
+		int64_t offset = 0;
+		int64_t roundTrip = 0;
+		std::chrono::steady_clock::time_point updated;
+	};
+
+	std::unordered_map<std::string, Estimate, NameHash, NameEqual> m_estimates;
+};
+
+} // namespace remote
@@ -0,0 +1,156 @@
+#include "CommandArgs.h"
+
+#include "mq/Plugin.h"
+
+namespace remote {
+
+static bool IsArgSeparator(char ch)
+{
+	return ch == ' ' || ch == '\t';
+}
+
+// Returns the next argument the same way tokenize_args splits them: whitespace separated,
+// with a quoted argument running up to its closing quote.
+static std::string_view NextArg(std::string_view line, size_t& pos)
+{
+	while (pos < line.size() && IsArgSeparator(line[pos]))
+		++pos;
+
+	if (pos >= line.size())
+		return {};
+
+	if (line[pos] == '"')
+	{
+		size_t start = ++pos;
+		size_t end = line.find('"', start);
+		if (end == std::string_view::npos)
+			end = line.size();
+
+		pos = std::min(end + 1, line.size());
+		return line.substr(start, end - start);
+	}
+
+	size_t start = pos;
+	while (pos < line.size() && !IsArgSeparator(line[pos]))
+		++pos;
+
+	return line.substr(start, pos - start);
+}
+
+std::optional<std::chrono::milliseconds> ParseDelay(std::string_view text)
+{
+	int64_t value = 0;
+	size_t digits = 0;
+	for (; digits < text.size() && text[digits] >= '0' && text[digits] <= '9'; ++digits)
+	{
+		value = value * 10 + (text[digits] - '0');
+		if (value > MAX_SCHEDULE_DELAY.count())
+			return std::nullopt;
+	}
+
+	if (digits == 0)
+		return std::nullopt;
+
+	std::string_view unit = text.substr(digits);
+	if (unit == "s")
+	{
+		value *= 1000;
+	}
+	else if (!unit.empty() && unit != "ms")
+	{
+		return std::nullopt;
+	}
+
+	if (value > MAX_SCHEDULE_DELAY.count())
+		return std::nullopt;
+
+	return std::chrono::milliseconds(value);
+}
+
+std::optional<RemoteCommandArgs> GetRemoteCommandArgs(const char* szLine)
+{
+	if (!szLine || !*szLine)
+	{
+		return std::nullopt;
+	}
+
+	RemoteCommandArgs result;
+	std::string_view line(szLine);
+	size_t pos = 0;
+
+	std::string_view arg = NextArg(line, pos);
+
+	// Optional +self
+	if (arg == "+self")
+	{
+		result.includeSelf = true;
+		arg = NextArg(line, pos);
+	}
+
+	// Optional @+<delay> schedules the command
+	if (arg.size() > 2 && arg[0] == '@' && arg[1] == '+')
+	{
+		std::optional<std::chrono::milliseconds> delay = ParseDelay(arg.substr(2));
+		if (!delay)
+		{
+			return std::nullopt;
+		}
+
+		result.scheduled = true;
+		result.delay = *delay;
+		arg = NextArg(line, pos);
+	}
+
+	// Channel, lowercased into the fixed buffer
+	if (arg.data() == nullptr)
+	{
+		return std::nullopt;
+	}
+
+	// Optional ! sends in the urgent lane
+	if (arg.size() > 1 && arg[0] == '!')
+	{
+		result.urgent = true;
+		arg.remove_prefix(1);
+	}
+
+	result.channelArg = arg;
+	if (arg.size() <= RemoteCommandArgs::MAX_CHANNEL_LENGTH)
+	{
+		std::transform(arg.begin(), arg.end(), result.m_channel,
+			[](char ch) { return static_cast<char>(std::tolower(static_cast<unsigned char>(ch))); });
+		result.m_channelLength = arg.size();
+	}
+
+	arg = NextArg(line, pos);
+
+	// Optional receiver (only if next arg does NOT start with '/' or '~')
+	if (!arg.empty() && arg[0] != '/' && arg[0] != '~')
+	{
+		result.receiver = arg;
+		ForEachReceiver(arg, [&](std::string_view) { ++result.receiverCount; });
+		arg = NextArg(line, pos);
+	}
+
+	// Optional ~key right before the message
+	if (!arg.empty() && arg[0] == '~')
+	{
+		result.coalesce = true;
+		result.key = arg.substr(1);
+		arg = NextArg(line, pos);
+	}
+
+	// Now arg should be the message component (starts with '/')
+	if (arg.empty() || arg[0] != '/')
+	{
+		// No valid message component
+		return std::nullopt;
+	}
+
+	// Message = remainder of original line starting at first message token
+	result.message = line.substr(arg.data() - line.data());
+
+	return result;
+}
+
+} // namespace remote
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string_view>
+
+namespace remote {
+
+// Arguments of /rc, viewing into the command line they were parsed from
+struct RemoteCommandArgs
+{
+	static constexpr size_t MAX_CHANNEL_LENGTH = 63;
+
+	bool includeSelf = false;
+	bool scheduled = false;                  // an @+<delay> argument was given
+	std::chrono::milliseconds delay{ 0 };    // how long after sending the command runs everywhere
+	bool urgent = false;         // channel was prefixed with !
+	std::string_view channelArg; // channel as it was typed, without the !
+	std::string_view receiver;   // empty when sending to the whole channel, may list several separated by commas
+	size_t receiverCount = 0;
+	bool coalesce = false;       // a ~key argument was given
+	std::string_view key;        // coalescing key, empty to use the message itself
+	std::string_view message;    // remainder of the line, still escaped
+
+	// Lowercased channel name, empty if the argument is too long to be a channel
+	std::string_view GetChannel() const { return { m_channel, m_channelLength }; }
+
+private:
+	friend std::optional<RemoteCommandArgs> GetRemoteCommandArgs(const char* szLine);
+
+	char m_channel[MAX_CHANNEL_LENGTH + 1] = {};
+	size_t m_channelLength = 0;
+};
+
+// Longest delay /rc @+<delay> accepts
+constexpr std::chrono::milliseconds MAX_SCHEDULE_DELAY{ 60000 };
+
+// Calls func with each name of a comma separated list, skipping empty ones
+template <typename Func>
+void ForEachReceiver(std::string_view receivers, Func&& func)
+{
+	while (!receivers.empty())
+	{
+		const size_t comma = receivers.find(',');
+		std::string_view name = receivers.substr(0, comma);
+		if (!name.empty())
+		{
+			func(name);
+		}
+
+		receivers = comma == std::string_view::npos ? std::string_view() : receivers.substr(comma + 1);
+	}
+}
+
+// Parses a delay such as 250ms, 2s or 250 (milliseconds), up to MAX_SCHEDULE_DELAY
+std::optional<std::chrono::milliseconds> ParseDelay(std::string_view text);
+
+// Parses the arguments of /rc [+self] [@+delay] [!]<channel> [character[,character...]] [~key] <message>, only
+// scanning up to the start of the message.
+std::optional<RemoteCommandArgs> GetRemoteCommandArgs(const char* szLine);
+
+} // namespace remote
@@ -0,0 +1,91 @@
+#include "CommandDictionary.h"
+
+#include <iterator>
+
+namespace remote {
+
+// Index 0 means no prefix. Entries are only ever appended, together with a version bump.
+static constexpr std::string_view COMMAND_PREFIXES[] = {
+	{},
+	"/target id ",
+	"/target ",
+	"/stand",
+	"/sit",
+	"/cast ",
+	"/useitem ",
+	"/stick ",
+	"/stick off",
+	"/moveto id ",
+	"/moveto loc ",
+	"/nav id ",
+	"/nav spawn ",
+	"/nav stop",
+	"/afollow on",
+	"/afollow off",
+	"/afollow spawn ",
+	"/attack on",
+	"/attack off",
+	"/assist ",
+	"/macro ",
+	"/endmacro",
+	"/mqpause on",
+	"/mqpause off",
+	"/keypress ",
+	"/say ",
+	"/gsay ",
+	"/rsay ",
+	"/echo ",
+	"/noparse ",
+	"/multiline ; ",
+	"/timed ",
+	"/docommand ",
+	"/lua run ",
+	"/lua stop ",
+	"/squelch ",
+	"/invite ",
+	"/disband",
+	"/raidinvite ",
+	"/raiddisband",
+	"/memspell ",
+	"/disc ",
+	"/alt activate ",
+	"/pet attack",
+	"/pet back off",
+	"/pet hold on",
+	"/face fast",
+	"/face id ",
+	"/click left target",
+	"/hidecorpse looted",
+	"/camp desktop",
+	"/consent ",
+	"/autoinventory",
+	"/notify ",
+	"/plugin ",
+	"/zone ",
+	"/travelto ",
+	"/boxr ",
+	"/cwtn ",
+	"/rc ",
+};
+
+uint32_t FindCommandPrefix(std::string_view command)
+{
+	uint32_t best = 0;
+	for (uint32_t i = 1; i < std::size(COMMAND_PREFIXES); ++i)
+	{
+		std::string_view prefix = COMMAND_PREFIXES[i];
+		if (prefix.size() > COMMAND_PREFIXES[best].size() && command.substr(0, prefix.size()) == prefix)
+		{
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+std::string_view GetCommandPrefix(uint32_t index)
+{
+	return index < std::size(COMMAND_PREFIXES) ? COMMAND_PREFIXES[index] : std::string_view();
+}
+
+} // namespace remote
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace remote {
+
+// Shared table of common command prefixes. Commands starting with an entry are sent as the
+// entry's index and the remainder of the command. Peers advertise the version they know and
+// only matching peers are sent encoded commands, so any change to the table must bump the version.
+constexpr uint32_t COMMAND_DICTIONARY_VERSION = 1;
+
+// Returns the index of the longest entry the command starts with, 0 if there is none
+uint32_t FindCommandPrefix(std::string_view command);
+
+// Returns the entry for an index, empty if the index is unknown
+std::string_view GetCommandPrefix(uint32_t index);
+
+} // namespace remote
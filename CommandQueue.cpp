@@ -0,0 +1,132 @@
+#include "CommandQueue.h"
+#include "Channel.h"
+
+namespace remote {
+
+bool CommandQueue::Push(QueuedCommand&& command)
+{
+	// a flood of bulk commands can't push out urgent ones
+	std::deque<QueuedCommand>& commands = m_lanes[static_cast<size_t>(command.lane)];
+
+	// the replaced command counts as handled, it is acknowledged without running
+	if (!command.key.empty() || m_options->coalesceIdentical)
+	{
+		auto it = std::find_if(commands.begin(), commands.end(), [&](const QueuedCommand& queued) {
+			return queued.channel == command.channel && queued.peer == command.peer
+				&& Coalesces(command.key, command.command, queued.key, queued.command, m_options->coalesceIdentical);
+		});
+		if (it != commands.end())
+		{
+			if (it->replyTo && it->channel)
+			{
+				it->channel->PostSuccess(it->replyTo);
+			}
+
+			commands.erase(it);
+			++m_coalesced;
+		}
+	}
+
+	if (commands.size() >= m_options->capacity)
+	{
+		switch (m_options->overflow)
+		{
+		case OverflowPolicy::DropOldest:
+			Refuse(commands.front());
+			commands.pop_front();
+			++m_dropped;
+			break;
+
+		case OverflowPolicy::DropNewest:
+			Refuse(command);
+			++m_dropped;
+			return false;
+
+		case OverflowPolicy::RunInline:
+			Run(command);
+			return true;
+		}
+	}
+
+	commands.push_back(std::move(command));
+	m_highWater = std::max(m_highWater, GetDepth());
+	return true;
+}
+
+std::deque<QueuedCommand>* CommandQueue::NextLane()
+{
+	for (std::deque<QueuedCommand>& commands : m_lanes)
+	{
+		if (!commands.empty())
+			return &commands;
+	}
+
+	return nullptr;
+}
+
+void CommandQueue::Drain()
+{
+	std::deque<QueuedCommand>* commands = NextLane();
+	if (!commands)
+		return;
+
+	const auto deadline = std::chrono::steady_clock::now() + m_options->budget;
+	do
+	{
+		// pop before running, DoCommand can push more commands onto the queue
+		QueuedCommand command = std::move(commands->front());
+		commands->pop_front();
+
+		Run(command);
+	} while ((commands = NextLane()) != nullptr && std::chrono::steady_clock::now() < deadline);
+}
+
+void CommandQueue::Detach(const Channel* channel)
+{
+	for (std::deque<QueuedCommand>& commands : m_lanes)
+	{
+		for (QueuedCommand& command : commands)
+		{
+			if (command.channel == channel)
+			{
+				command.channel = nullptr;
+			}
+		}
+	}
+}
+
+void CommandQueue::Refuse(const QueuedCommand& command)
+{
+	// the sender is still waiting for the reply when acknowledging after run
+	if (command.replyTo && command.channel)
+	{
+		command.channel->PostRefused(command.replyTo);
+	}
+}
+
+void CommandQueue::Run(QueuedCommand& command)
+{
+	if (command.channel)
+	{
+		command.channel->RecordQueueTime(command.peer.get(),
+			std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - command.queuedAt));
+
+		if (command.executeAt != 0)
+		{
+			command.channel->RecordExecution(command);
+		}
+	}
+
+	if (!command.dryRun)
+	{
+		DoCommand(command.command.c_str());
+	}
+	++m_executed;
+
+	if (command.replyTo && command.channel)
+	{
+		command.channel->PostSuccess(command.replyTo);
+	}
+}
+
+} // namespace remote
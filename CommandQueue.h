@@ -0,0 +1,99 @@
+#pragma once
+
+#include "TokenBucket.h"
+#include "mq/Plugin.h"
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace remote {
+
+class Channel;
+struct PeerInfo;
+
+enum class OverflowPolicy
+{
+	DropOldest,  // make room by discarding the oldest queued command
+	DropNewest,  // discard the command that didn't fit
+	RunInline,   // run the command that didn't fit right away
+};
+
+struct CommandQueueOptions
+{
+	size_t capacity = 256;                    // per lane
+	std::chrono::microseconds budget{ 2000 }; // time spent running commands per pulse
+	OverflowPolicy overflow = OverflowPolicy::DropOldest;
+	bool ackAfterRun = false;                 // personal messages are acknowledged once queued unless set
+	bool coalesceIdentical = false;           // a command replaces a waiting one with the same text, as if both had it as key
+};
+
+// True if a command with the given coalescing key replaces a waiting one
+inline bool Coalesces(std::string_view key, std::string_view command, std::string_view otherKey,
+	std::string_view otherCommand, bool identical)
+{
+	if (!key.empty())
+		return key == otherKey;
+
+	return identical && otherKey.empty() && command == otherCommand;
+}
+
+struct QueuedCommand
+{
+	Channel* channel = nullptr; // cleared if the channel goes away before the command runs
+	std::string command;
+	std::shared_ptr<postoffice::Message> replyTo; // acknowledged once the command has run
+	std::shared_ptr<PeerInfo> peer;               // sender, null for our own commands
+	bool dryRun = false;                          // replayed from a capture, goes through the queue without running
+	Lane lane = Lane::Bulk;
+	std::string key;                              // coalescing key, empty for none
+	int64_t executeAt = 0;                        // our wall clock time it was scheduled for, 0 if it wasn't
+	int64_t senderExecuteAt = 0;                  // the same time on the sender's clock
+	std::string scheduledBy;                      // sender the run is reported to, empty for our own commands
+	std::chrono::steady_clock::time_point queuedAt = std::chrono::steady_clock::now();
+};
+
+// Received commands wait here until ChannelManager::OnPulse drains them under a time budget.
+// Urgent commands have a queue of their own that is always drained first.
+class CommandQueue
+{
+public:
+	explicit CommandQueue(const CommandQueueOptions* options)
+		: m_options(options)
+	{
+	}
+
+	// Returns false if the command was dropped. A waiting command from the same channel and sender
+	// that the new one coalesces with is removed, see Coalesces.
+	bool Push(QueuedCommand&& command);
+
+	// Runs queued commands until the budget is spent, always running at least one
+	void Drain();
+
+	// Keeps the channel's queued commands, but forgets where to send their replies
+	void Detach(const Channel* channel);
+
+	size_t GetDepth() const { return GetDepth(Lane::Urgent) + GetDepth(Lane::Bulk); }
+	size_t GetDepth(Lane lane) const { return m_lanes[static_cast<size_t>(lane)].size(); }
+	size_t GetHighWater() const { return m_highWater; }
+	uint64_t GetDropped() const { return m_dropped; }
+	uint64_t GetExecuted() const { return m_executed; }
+	uint64_t GetCoalesced() const { return m_coalesced; }
+
+private:
+	void Run(QueuedCommand& command);
+	void Refuse(const QueuedCommand& command);
+	std::deque<QueuedCommand>* NextLane();
+
+	const CommandQueueOptions* m_options;
+	std::array<std::deque<QueuedCommand>, LANE_COUNT> m_lanes;
+	size_t m_highWater = 0;
+	uint64_t m_dropped = 0;
+	uint64_t m_executed = 0;
+	uint64_t m_coalesced = 0; // commands replaced by a later one before they ran
+};
+
+} // namespace remote
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+
+namespace remote {
+
+// Fixed size latency histogram with HDR style log-linear buckets. Each power of two range is
+// split into 32 linear buckets, which keeps values within ~3% from 1us up to ~71 minutes.
+class LatencyHistogram
+{
+public:
+	void Record(std::chrono::microseconds value)
+	{
+		uint64_t us = std::clamp<int64_t>(value.count(), 0, MAX_VALUE);
+		++m_counts[BucketIndex(us)];
+		++m_count;
+		m_total += us;
+		m_max = std::max(m_max, us);
+	}
+
+	// Returns the upper edge of the bucket holding the given percentile (0-100)
+	std::chrono::microseconds Percentile(double percentile) const
+	{
+		if (m_count == 0)
+			return std::chrono::microseconds(0);
+
+		uint64_t target = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(m_count) + 0.5);
+		target = std::clamp<uint64_t>(target, 1, m_count);
+
+		uint64_t seen = 0;
+		for (size_t i = 0; i < m_counts.size(); ++i)
+		{
+			seen += m_counts[i];
+			if (seen >= target)
+				return std::chrono::microseconds(std::min(BucketUpperEdge(i), m_max));
+		}
+
+		return std::chrono::microseconds(m_max);
+	}
+
+	std::chrono::microseconds Mean() const { return std::chrono::microseconds(m_count ? m_total / m_count : 0); }
+	std::chrono::microseconds Max() const { return std::chrono::microseconds(m_max); }
+	uint64_t GetCount() const { return m_count; }
+
+	void Reset() { *this = LatencyHistogram(); }
+
+private:
+	static constexpr int SUB_BUCKET_BITS = 5;
+	static constexpr uint64_t SUB_BUCKETS = 1ull << SUB_BUCKET_BITS;
+	static constexpr int RANGES = 32 - SUB_BUCKET_BITS + 1;
+	static constexpr int64_t MAX_VALUE = (1ll << 32) - 1;
+
+	static size_t BucketIndex(uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+			return static_cast<size_t>(value);
+
+		int shift = std::bit_width(value) - 1 - SUB_BUCKET_BITS;
+		return static_cast<size_t>((shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS));
+	}
+
+	static uint64_t BucketUpperEdge(size_t index)
+	{
+		if (index < SUB_BUCKETS)
+			return index;
+
+		int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+		uint64_t sub = index % SUB_BUCKETS + SUB_BUCKETS;
+		return ((sub + 1) << shift) - 1;
+	}
+
+	std::array<uint32_t, RANGES * SUB_BUCKETS> m_counts{};
+	uint64_t m_count = 0;
+	uint64_t m_total = 0;
+	uint64_t m_max = 0;
+};
+
+} // namespace remote
@@ -0,0 +1,400 @@
+#include "Logger.h"
+#include "ClockSync.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+namespace remote {
+
+static constexpr uint32_t LOG_FILE_MAGIC = 0x4c52514d; // "MQRL"
+static constexpr uint32_t LOG_FILE_VERSION = 1;
+
+namespace {
+
+// Reads back the arguments packed by Logger::Record
+class ArgReader
+{
+public:
+	ArgReader(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+	bool Next(LogArg::Type& type, int64_t& i, uint64_t& u, double& d, const char*& s)
+	{
+		if (m_pos >= m_size)
+			return false;
+
+		type = static_cast<LogArg::Type>(m_data[m_pos++]);
+		switch (type)
+		{
+		case LogArg::Type::Int:
+			memcpy(&i, m_data + m_pos, sizeof(i));
+			u = static_cast<uint64_t>(i);
+			d = static_cast<double>(i);
+			m_pos += sizeof(i);
+			break;
+
+		case LogArg::Type::UInt:
+			memcpy(&u, m_data + m_pos, sizeof(u));
+			i = static_cast<int64_t>(u);
+			d = static_cast<double>(u);
+			m_pos += sizeof(u);
+			break;
+
+		case LogArg::Type::Double:
+			memcpy(&d, m_data + m_pos, sizeof(d));
+			i = static_cast<int64_t>(d);
+			u = static_cast<uint64_t>(i);
+			m_pos += sizeof(d);
+			break;
+
+		case LogArg::Type::String: {
+			uint16_t length;
+			memcpy(&length, m_data + m_pos, sizeof(length));
+			s = m_data + m_pos + sizeof(length);
+			m_pos += sizeof(length) + length + 1;
+			break;
+		}
+		}
+
+		return true;
+	}
+
+private:
+	const char* m_data;
+	size_t m_size;
+	size_t m_pos = 0;
+};
+
+} // namespace
+
+Logger::Logger()
+{
+	for (size_t i = 0; i < RING_SIZE; ++i)
+		m_ring[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+Logger::~Logger()
+{
+	SetLogFile({});
+}
+
+void Logger::Record(LogFlags flag, const char* szFormat, std::initializer_list<LogArg> args)
+{
+	// claim a slot, any thread may log
+	size_t pos = m_head.load(std::memory_order_relaxed);
+	Slot* slot;
+	for (;;)
+	{
+		slot = &m_ring[pos & (RING_SIZE - 1)];
+		const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+		if (diff == 0)
+		{
+			if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			// full until the next flush
+			m_overflow.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+		{
+			pos = m_head.load(std::memory_order_relaxed);
+		}
+	}
+
+	LogRecord& record = slot->record;
+	record.flag = flag;
+	record.format = szFormat;
+	record.time = WallClockMicros();
+
+	// strings are copied, they won't outlive the call. Anything that doesn't fit is left out.
+	char* data = record.data;
+	size_t size = 0;
+	for (const LogArg& arg : args)
+	{
+		if (arg.type == LogArg::Type::String)
+		{
+			constexpr size_t overhead = 1 + sizeof(uint16_t) + 1;
+			if (size + overhead > RECORD_DATA_SIZE)
+				break;
+
+			const uint16_t length = static_cast<uint16_t>(std::min(arg.length, RECORD_DATA_SIZE - size - overhead));
+			data[size++] = static_cast<char>(arg.type);
+			memcpy(data + size, &length, sizeof(length));
+			size += sizeof(length);
+			memcpy(data + size, arg.s, length);
+			size += length;
+			data[size++] = 0;
+		}
+		else
+		{
+			if (size + 1 + sizeof(int64_t) > RECORD_DATA_SIZE)
+				break;
+
+			data[size++] = static_cast<char>(arg.type);
+			memcpy(data + size, &arg.i, sizeof(int64_t)); // all of the numeric members are 8 bytes
+			size += sizeof(int64_t);
+		}
+	}
+	record.size = static_cast<uint16_t>(size);
+
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+// printf style formatting of a record. Every conversion is handed to snprintf with a length
+// modifier matching the packed argument, so integer arguments of any size print correctly.
+size_t Logger::Format(const LogRecord& record, char* buffer, size_t bufferSize)
+{
+	ArgReader reader(record.data, record.size);
+	size_t out = 0;
+
+	auto append = [&](const char* text, size_t length) {
+		length = std::min(length, bufferSize - 1 - out);
+		memcpy(buffer + out, text, length);
+		out += length;
+	};
+
+	auto appendFormatted = [&](int written) {
+		if (written > 0)
+			out += std::min(static_cast<size_t>(written), bufferSize - 1 - out);
+	};
+
+	LogArg::Type type;
+	int64_t i;
+	uint64_t u;
+	double d;
+	const char* s = nullptr;
+
+	const char* p = record.format;
+	while (*p && out < bufferSize - 1)
+	{
+		if (*p != '%')
+		{
+			const char* start = p;
+			while (*p && *p != '%')
+				++p;
+			append(start, p - start);
+			continue;
+		}
+
+		if (p[1] == '%')
+		{
+			append("%", 1);
+			p += 2;
+			continue;
+		}
+
+		// copy the flags, width and precision, taking * from the arguments
+		char spec[32];
+		size_t length = 0;
+		spec[length++] = *p++;
+
+		auto copySpec = [&](const char* chars) {
+			while (*p && strchr(chars, *p))
+			{
+				if (length < sizeof(spec) - 8)
+					spec[length++] = *p;
+				++p;
+			}
+		};
+
+		auto copyNumber = [&]() {
+			if (*p == '*')
+			{
+				++p;
+				if (reader.Next(type, i, u, d, s) && length < sizeof(spec) - 16)
+					length += snprintf(spec + length, sizeof(spec) - length, "%d", static_cast<int>(i));
+			}
+			else
+			{
+				copySpec("0123456789");
+			}
+		};
+
+		copySpec("-+ #0");
+		copyNumber();
+		if (*p == '.')
+		{
+			spec[length++] = *p++;
+			copyNumber();
+		}
+
+		// the length modifier is replaced to match the argument
+		while (*p && strchr("hlLqjzt", *p))
+			++p;
+
+		const char conversion = *p;
+		if (!conversion)
+			break;
+		++p;
+
+		if (!reader.Next(type, i, u, d, s))
+		{
+			append("?", 1);
+			continue;
+		}
+
+		switch (conversion)
+		{
+		case 'd':
+		case 'i':
+			spec[length++] = 'l';
+			spec[length++] = 'l';
+			spec[length++] = conversion;
+			spec[length] = 0;
+			appendFormatted(snprintf(buffer + out, bufferSize - out, spec, static_cast<long long>(i)));
+			break;
+
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			spec[length++] = 'l';
+			spec[length++] = 'l';
+			spec[length++] = conversion;
+			spec[length] = 0;
+			appendFormatted(snprintf(buffer + out, bufferSize - out, spec, static_cast<unsigned long long>(u)));
+			break;
+
+		case 'c':
+			spec[length++] = conversion;
+			spec[length] = 0;
+			appendFormatted(snprintf(buffer + out, bufferSize - out, spec, static_cast<int>(i)));
+			break;
+
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			spec[length++] = conversion;
+			spec[length] = 0;
+			appendFormatted(snprintf(buffer + out, bufferSize - out, spec, d));
+			break;
+
+		case 's':
+			spec[length++] = conversion;
+			spec[length] = 0;
+			appendFormatted(snprintf(buffer + out, bufferSize - out, spec, type == LogArg::Type::String ? s : "?"));
+			break;
+
+		default:
+			append("?", 1);
+			break;
+		}
+	}
+
+	buffer[out] = 0;
+	return out;
+}
+
+void Logger::Flush()
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	// token bucket, bursts of up to a second's worth of messages
+	m_tokens = std::min<double>(m_rateLimit,
+		m_tokens + std::chrono::duration<double>(now - m_lastRefill).count() * m_rateLimit);
+	m_lastRefill = now;
+
+	const auto deadline = now + m_budget;
+	char buffer[2048];
+
+	for (;;)
+	{
+		Slot& slot = m_ring[m_tail & (RING_SIZE - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1)
+			break;
+
+		// take the token first, a record nothing will write isn't worth formatting
+		bool toChat = true;
+		if (m_rateLimit > 0)
+		{
+			if (m_tokens >= 1)
+			{
+				m_tokens -= 1;
+			}
+			else
+			{
+				toChat = false;
+				++m_suppressed;
+			}
+		}
+
+		if (toChat || m_logFile.is_open())
+		{
+			const size_t length = Format(slot.record, buffer, sizeof(buffer));
+
+			if (m_logFile.is_open())
+				WriteLogFile(slot.record, buffer, length);
+
+			if (toChat)
+				WriteChatColor(buffer);
+		}
+
+		slot.sequence.store(m_tail + RING_SIZE, std::memory_order_release);
+		++m_tail;
+
+		// the rest waits for the next pulse
+		if (std::chrono::steady_clock::now() >= deadline)
+			break;
+	}
+
+	m_suppressed += m_overflow.exchange(0, std::memory_order_relaxed);
+
+	// at most one summary a second, so the summary can't flood chat either
+	if (m_suppressed > 0 && now >= m_nextSummary)
+	{
+		WriteChatf(PLUGIN_MSG "\ay%llu\ax log message(s) suppressed.", static_cast<unsigned long long>(m_suppressed));
+		m_suppressed = 0;
+		m_nextSummary = now + std::chrono::seconds(1);
+	}
+
+	if (m_logFile.is_open())
+		m_logFile.flush();
+}
+
+void Logger::SetLogFile(const std::string& path)
+{
+	if (m_logFile.is_open())
+		m_logFile.close();
+
+	if (path.empty())
+		return;
+
+	std::error_code ec;
+	const bool isNew = !std::filesystem::exists(path, ec) || std::filesystem::file_size(path, ec) == 0;
+
+	m_logFile.open(path, std::ios::binary | std::ios::app);
+	if (!m_logFile.is_open())
+	{
+		WriteChatf(PLUGIN_MSG "\arCould not open log file \ay%s\ax.", path.c_str());
+		return;
+	}
+
+	if (isNew)
+	{
+		m_logFile.write(reinterpret_cast<const char*>(&LOG_FILE_MAGIC), sizeof(LOG_FILE_MAGIC));
+		m_logFile.write(reinterpret_cast<const char*>(&LOG_FILE_VERSION), sizeof(LOG_FILE_VERSION));
+	}
+}
+
+void Logger::WriteLogFile(const LogRecord& record, const char* text, size_t length)
+{
+	const uint32_t flag = static_cast<uint32_t>(record.flag);
+	const uint16_t size = static_cast<uint16_t>(length);
+
+	m_logFile.write(reinterpret_cast<const char*>(&record.time), sizeof(record.time));
+	m_logFile.write(reinterpret_cast<const char*>(&flag), sizeof(flag));
+	m_logFile.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	m_logFile.write(text, size);
+}
+
+} // namespace remote
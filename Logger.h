@@ -3,10 +3,61 @@
 #include "mq/base/Enum.h"
 #include "mq/Plugin.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
 #define PLUGIN_MSG "\am[MQRemote]\ax "
 
 namespace remote {
 
+// A single argument to Logger::Log, captured without formatting it
+struct LogArg
+{
+	enum class Type : uint8_t { Int, UInt, Double, String };
+
+	Type type;
+	union
+	{
+		int64_t i;
+		uint64_t u;
+		double d;
+		const char* s;
+	};
+	size_t length = 0; // for strings
+
+	LogArg(const char* value) : type(Type::String), s(value ? value : "(null)"), length(std::char_traits<char>::length(s)) {}
+	LogArg(const std::string& value) : type(Type::String), s(value.c_str()), length(value.size()) {}
+
+	template <typename T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+	LogArg(T value)
+	{
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			type = Type::Double;
+			d = static_cast<double>(value);
+		}
+		else if constexpr (std::is_signed_v<T>)
+		{
+			type = Type::Int;
+			i = static_cast<int64_t>(value);
+		}
+		else
+		{
+			type = Type::UInt;
+			u = static_cast<uint64_t>(value);
+		}
+	}
+};
+
+// Log messages are recorded into a lock-free ring buffer as a format string and raw arguments,
+// and are only formatted and written to chat from OnPulse, under a time budget and rate limit.
+// Format strings must be string literals, they are kept by pointer until the message is written.
 class Logger
 {
 public:
@@ -22,36 +73,82 @@ public:
 		DEFAULT_FLAGS = LOG_ERROR | LOG_CONNECTIONS,
 	};
 
-	Logger() = default;
+	Logger();
+	~Logger();
 
-	void Log(LogFlags flag, const char* szFormat, ...) const
+	template <typename... Args>
+	void Log(LogFlags flag, const char* szFormat, const Args&... args)
 	{
 		if (!IsEnabled(flag))
 			return;
 
-		va_list args;
-		va_start(args, szFormat);
-
-		mq::VWriteChatColor(szFormat, args);
-
-		va_end(args);
+		Record(flag, szFormat, { LogArg(args)... });
 	}
 
+	// Formats and writes recorded messages, called once per pulse. Messages over the rate
+	// limit are counted and reported as suppressed instead of written to chat.
+	void Flush();
+
 	// Check if a specific logging flag is enabled
 	bool IsEnabled(LogFlags flag) const;
 
-	void SetFlags(LogFlags flags) { m_flags = flags; }
-	LogFlags GetFlags() const { return m_flags; }
+	void SetFlags(LogFlags flags) { m_flags.store(flags, std::memory_order_relaxed); }
+	LogFlags GetFlags() const { return m_flags.load(std::memory_order_relaxed); }
+
+	// chat output limits, a rate of 0 writes everything
+	void SetRateLimit(int messagesPerSecond) { m_rateLimit = messagesPerSecond; m_tokens = messagesPerSecond; }
+	void SetBudget(std::chrono::microseconds budget) { m_budget = budget; }
+
+	// Also writes every message to a binary log file, see README.md for the format. An empty path closes it.
+	void SetLogFile(const std::string& path);
+	bool HasLogFile() const { return m_logFile.is_open(); }
 
 private:
-	LogFlags m_flags{ LogFlags::DEFAULT_FLAGS };
+	static constexpr size_t RING_SIZE = 256; // power of two
+	static constexpr size_t RECORD_DATA_SIZE = 480;
+
+	struct LogRecord
+	{
+		LogFlags flag;
+		const char* format;
+		int64_t time; // wall clock in microseconds
+		uint16_t size;
+		char data[RECORD_DATA_SIZE]; // packed arguments
+	};
+
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		LogRecord record;
+	};
+
+	void Record(LogFlags flag, const char* szFormat, std::initializer_list<LogArg> args);
+	static size_t Format(const LogRecord& record, char* buffer, size_t bufferSize);
+	void WriteLogFile(const LogRecord& record, const char* text, size_t length);
+
+	std::atomic<LogFlags> m_flags{ LogFlags::DEFAULT_FLAGS };
+
+	// bounded multi-producer queue, consumed by Flush
+	std::array<Slot, RING_SIZE> m_ring;
+	std::atomic<size_t> m_head{ 0 };
+	size_t m_tail = 0;
+	std::atomic<uint64_t> m_overflow{ 0 }; // records lost to a full ring
+
+	int m_rateLimit = 50;
+	std::chrono::microseconds m_budget{ 500 };
+	double m_tokens = 50;
+	std::chrono::steady_clock::time_point m_lastRefill = std::chrono::steady_clock::now();
+	uint64_t m_suppressed = 0;
+	std::chrono::steady_clock::time_point m_nextSummary;
+
+	std::ofstream m_logFile;
 };
 
 constexpr bool has_bitwise_operations(Logger::LogFlags) { return true; }
 
 inline bool Logger::IsEnabled(LogFlags flag) const
 {
-	return !!(m_flags & flag);
+	return !!(GetFlags() & flag);
 }
 
 } // namespace remote
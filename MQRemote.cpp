@@ -1,6 +1,9 @@
 ﻿
 #include "ChannelManager.h"
+#include "CommandArgs.h"
 #include "Logger.h"
+#include "RemoteType.h"
+#include "Settings.h"
 
 #include "routing/PostOffice.h"
 #include "mq/Plugin.h"
@@ -12,95 +15,115 @@ namespace remote {
 
 constexpr std::chrono::milliseconds UPDATE_TICK_MILLISECONDS{ 1000 };
 
-constexpr std::string_view GLOBAL_HELP = "/rc [+self] global <message>\n/rc global <character> <message>";
-constexpr std::string_view SERVER_HELP = "/rc [+self] server <message>\n/rc server <character> <message>\n/rc <character> <message>";
-constexpr std::string_view GROUP_HELP = "/rc [+self] group <message>\n/rc group <character> <message>";
-constexpr std::string_view RAID_HELP = "/rc [+self] raid <message>\n/rc raid <character> <message>";
-constexpr std::string_view ZONE_HELP = "/rc [+self] zone <message>\n/rc zone <character> <message>";
+constexpr std::string_view GLOBAL_HELP = "/rc [+self] [!]global <message>\n/rc global <character> <message>";
+constexpr std::string_view SERVER_HELP = "/rc [+self] [!]server <message>\n/rc server <character> <message>\n/rc <character> <message>";
+constexpr std::string_view GROUP_HELP = "/rc [+self] [!]group <message>\n/rc group <character> <message>";
+constexpr std::string_view RAID_HELP = "/rc [+self] [!]raid <message>\n/rc raid <character> <message>";
+constexpr std::string_view ZONE_HELP = "/rc [+self] [!]zone <message>\n/rc zone <character> <message>";
+constexpr std::string_view TOPIC_HELP = "/rc [+self] [!]<topic.name> <message>\n/rcjoin <topic.*>";
 
 static ChannelManager* gChannels = nullptr;
 static Logger* gLogger = nullptr;
+static Settings* gSettings = nullptr;
 
-struct RemoteCommandArgs
+// Sends a personal command, or a multi-recipient one if several receivers are listed
+static void SendToReceivers(Channel* channel, std::string_view receivers, size_t count, std::string command, SendOptions options)
 {
-	bool includeSelf = false;
-	std::string channel;
-	std::optional<std::string> receiver;
-	std::string message;
-};
-
-static std::optional<RemoteCommandArgs> GetRemoteCommandArgs(const char* szLine)
-{
-	if (!szLine || !*szLine)
+	if (count == 0)
 	{
-		return std::nullopt;
+		WriteChatf(PLUGIN_MSG "Syntax: /rc [+self] [@+delay] [!]<channel> [character[,character...]] [~key] <message>");
+		return;
 	}
 
-	RemoteCommandArgs result{};
-	std::string_view line(szLine);
-	std::vector<std::string_view> args = tokenize_args(line);
-	size_t i = 0;
-
-	// Optional +self
-	if (i < args.size() && args[i] == "+self")
+	if (count == 1)
 	{
-		result.includeSelf = true;
-		++i;
+		std::string receiver;
+		ForEachReceiver(receivers, [&](std::string_view name) { receiver = name; });
+		channel->SendCommand(std::move(receiver), std::move(command), std::move(options));
+		return;
 	}
 
-	// Need at least channel + message
-	if (i + 1 >= args.size())
+	std::vector<std::string> names;
+	names.reserve(count);
+	ForEachReceiver(receivers, [&](std::string_view name) { names.emplace_back(name); });
+	channel->SendCommand(std::move(names), std::move(command), nullptr, std::move(options));
+}
+
+static void RcCmd(const PlayerClient*, const char* szLine)
+{
+	std::optional<RemoteCommandArgs> commandArgs = GetRemoteCommandArgs(szLine);
+	if (!commandArgs)
 	{
-		return std::nullopt;
+		WriteChatf(PLUGIN_MSG "Syntax: /rc [+self] [@+delay] [!]<channel> [character[,character...]] [~key] <message>");
+		return;
 	}
 
-	// Parse channel
-	result.channel = mq::to_lower_copy(args[i]);
-	++i;
+	// the unescaped command is the only copy made, it is moved into the outgoing message
+	std::string unescaped = unescape_args(commandArgs->message);
+	std::string_view channelName = commandArgs->GetChannel();
 
-	// Optional receiver (only if next arg does NOT start with '/')
-	if (i < args.size() && !args[i].empty() && args[i][0] != '/')
+	SendOptions options;
+	options.urgent = commandArgs->urgent;
+	if (commandArgs->coalesce)
 	{
-		result.receiver = std::string(args[i]);
-		++i;
+		options.key = commandArgs->key.empty() ? unescaped : std::string(commandArgs->key);
 	}
-
-	// Now args[i] should be the message component (starts with '/')
-	if (i >= args.size() || args[i].empty() || args[i][0] != '/')
+	if (commandArgs->scheduled)
 	{
-		// No valid message component
-		return std::nullopt;
+		options.executeAt = WallClockMicros() + std::chrono::duration_cast<std::chrono::microseconds>(commandArgs->delay).count();
 	}
 
-	// Message = remainder of original line starting at first message token
-	result.message = std::string(line.substr(args[i].data() - line.data()));
-
-	return result;
-}
-
-static void RcCmd(const PlayerClient*, const char* szLine)
-{
-	std::optional<RemoteCommandArgs> commandArgs = GetRemoteCommandArgs(szLine);
-	if (!commandArgs)
+	// topics are published on the topic channel, to whoever subscribed to a pattern matching them
+	if (IsTopicName(channelName))
 	{
-		WriteChatf(PLUGIN_MSG "Syntax: /rc [+self] <channel> [character] <message>");
+		if (!commandArgs->receiver.empty() || !TopicTrie::IsValid(channelName) || channelName.find('*') != std::string_view::npos)
+		{
+			WriteChatf(PLUGIN_MSG "Syntax: /rc [+self] [@+delay] [!]<topic> [~key] <message>, the topic can't contain *");
+			return;
+		}
+
+		gChannels->SendTopic(channelName, std::move(unescaped), commandArgs->includeSelf, std::move(options));
 		return;
 	}
 
-	std::string unescaped = unescape_args(commandArgs->message);
-	Channel* channel = gChannels->FindChannel(commandArgs->channel);
-	if (!channel) // No valid channel available
+	ChannelHandle handle = channelName.empty() ? ChannelHandle::Invalid : gChannels->FindHandle(channelName);
+	Channel* channel = gChannels->GetChannel(handle);
+	if (!channel && gChannels->IsSuspended(handle)) // zoning or changing game state, sent once it is back
 	{
-		channel = gChannels->GetServerChannel();
-		channel->SendCommand(std::move(commandArgs->channel), std::move(unescaped));
+		std::vector<std::string> receivers;
+		ForEachReceiver(commandArgs->receiver, [&](std::string_view name) { receivers.emplace_back(name); });
+		gChannels->HoldCommand(handle, std::move(receivers), std::move(unescaped), commandArgs->includeSelf, std::move(options));
 	}
-	else if (commandArgs->receiver)
+	else if (!channel) // No valid channel available
 	{
-		channel->SendCommand(std::move(*commandArgs->receiver), std::move(unescaped));
+		std::string_view receivers = channelName.empty() ? commandArgs->channelArg : channelName;
+		size_t count = 0;
+		ForEachReceiver(receivers, [&](std::string_view) { ++count; });
+
+		// characters are reached on the server channel, which is away while zoning too
+		Channel* server = gChannels->GetServerChannel();
+		if (!server && count > 0 && gChannels->IsSuspended(ChannelHandle::Server))
+		{
+			std::vector<std::string> names;
+			ForEachReceiver(receivers, [&](std::string_view name) { names.emplace_back(name); });
+			gChannels->HoldCommand(ChannelHandle::Server, std::move(names), std::move(unescaped), false, std::move(options));
+		}
+		else if (!server)
+		{
+			WriteChatf(PLUGIN_MSG "Can't send to \aw%.*s\ax, the server channel isn't open", static_cast<int>(receivers.size()), receivers.data());
+		}
+		else
+		{
+			SendToReceivers(server, receivers, count, std::move(unescaped), std::move(options));
+		}
+	}
+	else if (!commandArgs->receiver.empty())
+	{
+		SendToReceivers(channel, commandArgs->receiver, commandArgs->receiverCount, std::move(unescaped), std::move(options));
 	}
 	else 
 	{
-		channel->SendCommand(std::move(unescaped), commandArgs->includeSelf);
+		channel->SendCommand(std::move(unescaped), commandArgs->includeSelf, std::move(options));
 	}
 }
 
@@ -126,10 +149,324 @@ static void RcLeaveCmd(const PlayerClient*, const char* szLine)
 	gChannels->LeaveCustomChannel(szName, szAuto);
 }
 
-static bool DrawCustomChannelRow(const Channel& channel, const std::string_view& helpText, const bool canLeave = false)
+static void RcStatsCmd(const PlayerClient*, const char*)
+{
+	const BatchOptions& batch = gChannels->GetBatchOptions();
+	WriteChatf(PLUGIN_MSG "Batching: \aw%s\ax (interval \aw%d\axms, max \aw%d\ax)", batch.enabled ? "on" : "off",
+		static_cast<int>(batch.flushInterval.count()), static_cast<int>(batch.maxSize));
+
+	const CommandQueue& commands = gChannels->GetCommandQueue();
+	WriteChatf(PLUGIN_MSG "Command queue: depth \aw%d\ax (urgent \aw%d\ax), high water \aw%d\ax, executed \aw%llu\ax, coalesced \ag%llu\ax, dropped \ar%llu\ax",
+		static_cast<int>(commands.GetDepth()), static_cast<int>(commands.GetDepth(Lane::Urgent)), static_cast<int>(commands.GetHighWater()),
+		commands.GetExecuted(), commands.GetCoalesced(), commands.GetDropped());
+
+	const Scheduler& scheduler = gChannels->GetScheduler();
+	const LatencyHistogram& lateness = scheduler.GetLateness();
+	const LatencyHistogram& spread = scheduler.GetSpread();
+	WriteChatf(PLUGIN_MSG "Scheduled: waiting \aw%d\ax of \aw%llu\ax, ran late p50 \aw%.1f\axms p99 \aw%.1f\axms max \aw%.1f\axms, spread over \aw%llu\ax send(s) p50 \aw%.1f\axms p99 \aw%.1f\axms last \aw%.1f\axms",
+		static_cast<int>(scheduler.GetPending()), scheduler.GetScheduled(), lateness.Percentile(50).count() / 1000.0,
+		lateness.Percentile(99).count() / 1000.0, lateness.Max().count() / 1000.0, spread.GetCount(),
+		spread.Percentile(50).count() / 1000.0, spread.Percentile(99).count() / 1000.0, scheduler.GetLastSpread().count() / 1000.0);
+
+	const ReceivePipeline& pipeline = gChannels->GetReceivePipeline();
+	WriteChatf(PLUGIN_MSG "Decode thread: \aw%s\ax, decoded \aw%llu\ax, backlog \aw%d\ax, held back while the queue was full \ay%llu\ax",
+		pipeline.IsRunning() ? "on" : "off", pipeline.GetDrained(), static_cast<int>(pipeline.GetBacklog()), pipeline.GetOverflowed());
+
+	const Multiplexer& multiplexer = gChannels->GetMultiplexer();
+	WriteChatf(PLUGIN_MSG "Postoffice: multiplexed \aw%s\ax, actors registered \aw%llu\ax, routes \aw%d\ax, messages for other channels \aw%llu\ax",
+		multiplexer.IsEnabled() ? "on" : "off", multiplexer.GetRegistrations(), static_cast<int>(multiplexer.GetRouteCount()),
+		multiplexer.GetUnrouted());
+
+	for (const auto& [label, ready] : { std::pair{ "login", &gChannels->GetLoginStats() }, std::pair{ "zoning", &gChannels->GetZoneStats() } })
+	{
+		if (ready->open.GetCount() == 0)
+			continue;
+
+		WriteChatf(PLUGIN_MSG "Ready after %s: channels open p50 \aw%.1f\ax / max \aw%.1f\ax ms with \aw%llu\ax registration(s), first message p50 \aw%.1f\ax / max \aw%.1f\ax ms",
+			label, ready->open.Percentile(50).count() / 1000.0, ready->open.Max().count() / 1000.0, ready->lastRegistrations,
+			ready->heard.Percentile(50).count() / 1000.0, ready->heard.Max().count() / 1000.0);
+	}
+
+	WriteChatf(PLUGIN_MSG "Outbox: depth \aw%d\ax, held \aw%llu\ax, dropped \ar%llu\ax",
+		static_cast<int>(gChannels->GetOutboxDepth()), gChannels->GetOutboxHeld(), gChannels->GetOutboxDropped());
+
+	const Observers& observers = gChannels->GetObservers();
+	WriteChatf(PLUGIN_MSG "Observers: observing \aw%d\ax value(s), \aw%d\ax observer(s) of \aw%d\ax value(s), updates sent \aw%llu\ax with \aw%llu\ax value(s), bytes saved \ag%llu\ax",
+		static_cast<int>(observers.GetObservedCount()), static_cast<int>(observers.GetSubscriberCount()),
+		static_cast<int>(observers.GetSubscriptionCount()), observers.GetUpdatesSent(), observers.GetValuesSent(), observers.GetBytesSaved());
+
+	WriteChatf(PLUGIN_MSG "Settings: changes \aw%llu\ax, file writes \aw%llu\ax", gSettings->GetChanges(), gSettings->GetWrites());
+
+	const TrafficCapture& capture = gChannels->GetCapture();
+	if (capture.IsActive())
+	{
+		WriteChatf(PLUGIN_MSG "Capture: \aw%s\ax, records \aw%llu\ax, bytes \aw%llu\ax, rotations \aw%llu\ax, dropped \ar%llu\ax",
+			capture.GetPath().c_str(), capture.GetRecords(), capture.GetBytes(), capture.GetRotations(), capture.GetDropped());
+	}
+
+	gChannels->ForEachChannel([](const Channel& channel) {
+		const ChannelStats& stats = channel.GetStats();
+		WriteChatf(PLUGIN_MSG "\aw%s\ax: commands \aw%llu\ax, posts \aw%llu\ax, posts saved \ag%llu\ax, compression \ag%.2f\ax:1, own echoes dropped \aw%llu\ax, coalesced \ag%llu\ax",
+			channel.GetDnsName().data(), stats.commandsSent, stats.postsSent, stats.PostsSaved(), stats.CompressionRatio(), stats.echoesDropped,
+			stats.coalesced);
+		WriteChatf(PLUGIN_MSG "  members \aw%d\ax, sends to absent characters failed \ar%llu\ax",
+			static_cast<int>(channel.GetMemberCount()), stats.absentSends);
+		if (channel.GetHandle() == ChannelHandle::Topic)
+		{
+			WriteChatf(PLUGIN_MSG "  subscriptions \aw%d\ax, topics not subscribed to \aw%llu\ax",
+				static_cast<int>(gChannels->GetTopics().GetPatterns().size()), stats.topicsFiltered);
+		}
+
+		for (Lane lane : { Lane::Urgent, Lane::Bulk })
+		{
+			const LaneStats& laneStats = stats.GetLane(lane);
+			WriteChatf(PLUGIN_MSG "  %s%s: sent \aw%llu\ax, throttled \ay%llu\ax (held \aw%d\ax), dropped \ar%llu\ax, refused \ar%llu\ax",
+				lane == Lane::Urgent ? "urgent" : "bulk", channel.GetDefaultLane() == lane ? " (default)" : "",
+				laneStats.sent, laneStats.throttled, static_cast<int>(channel.GetThrottledDepth(lane)), laneStats.dropped, laneStats.refused);
+		}
+
+		channel.ForEachReceiver([](const ReceiverState& receiver) {
+			WriteChatf(PLUGIN_MSG "  -> \ay%s\ax: in flight \aw%d\ax, waiting \aw%d\ax, acked \ag%llu\ax, retried \ay%llu\ax, failed \ar%llu\ax, timed out \ar%llu\ax, dropped \ar%llu\ax, reply p50 \aw%.1f\axms p99 \aw%.1f\axms",
+				receiver.name.c_str(), static_cast<int>(receiver.inFlight.size()), static_cast<int>(receiver.waiting.size()),
+				receiver.acked, receiver.retried, receiver.failed, receiver.timedOut, receiver.dropped,
+				receiver.latency.Percentile(50).count() / 1000.0, receiver.latency.Percentile(99).count() / 1000.0);
+		});
+	});
+}
+
+static void RcCaptureCmd(const PlayerClient*, const char* szLine)
+{
+	char szArg[MAX_STRING] = {};
+	GetArg(szArg, szLine, 1);
+
+	const TrafficCapture& capture = gChannels->GetCapture();
+	if (ci_equals(szArg, "on"))
+	{
+		if (gChannels->StartCapture())
+		{
+			WriteChatf(PLUGIN_MSG "Capturing traffic to \aw%s\ax", capture.GetPath().c_str());
+		}
+	}
+	else if (ci_equals(szArg, "off"))
+	{
+		gChannels->StopCapture();
+		WriteChatf(PLUGIN_MSG "Capture stopped");
+	}
+	else
+	{
+		WriteChatf(PLUGIN_MSG "Syntax: /rccapture on|off");
+	}
+}
+
+static void RcReplayCmd(const PlayerClient*, const char* szLine)
+{
+	char szFile[MAX_STRING] = {};
+	char szSpeed[MAX_STRING] = {};
+	char szRun[MAX_STRING] = {};
+
+	GetArg(szFile, szLine, 1);
+	GetArg(szSpeed, szLine, 2); // optional
+	GetArg(szRun, szLine, 3);   // optional
+
+	if (szFile[0] == 0)
+	{
+		WriteChatf(PLUGIN_MSG "Syntax: /rcreplay <file> [speed] [run] | stop");
+		return;
+	}
+
+	if (ci_equals(szFile, "stop"))
+	{
+		gChannels->StopReplay();
+		WriteChatf(PLUGIN_MSG "Replay stopped");
+		return;
+	}
+
+	// file names without a directory are looked up in the logs folder
+	std::string path = strpbrk(szFile, "/\\") ? szFile : fmt::format("{}/{}", gPathLogs, szFile);
+	const double speed = szSpeed[0] ? atof(szSpeed) : 1.0;
+	const bool run = ci_equals(szRun, "run");
+
+	if (gChannels->StartReplay(path, speed, run))
+	{
+		WriteChatf(PLUGIN_MSG "Replaying \aw%s\ax at \aw%.1f\axx%s", path.c_str(), speed, run ? ", running commands" : "");
+	}
+}
+
+static void RcObserveCmd(const PlayerClient*, const char* szLine)
+{
+	char szCharacter[MAX_STRING] = {};
+	GetArg(szCharacter, szLine, 1);
+
+	Observers& observers = gChannels->GetObservers();
+	if (szCharacter[0] == 0)
+	{
+		WriteChatf(PLUGIN_MSG "Observing \aw%d\ax value(s), \aw%d\ax observer(s) watching \aw%d\ax of ours",
+			static_cast<int>(observers.GetObservedCount()), static_cast<int>(observers.GetSubscriberCount()),
+			static_cast<int>(observers.GetSubscriptionCount()));
+
+		observers.ForEachObserved([](const std::string& name, const ObservedValue& value, bool fresh) {
+			WriteChatf(PLUGIN_MSG "  \ay%s\ax %s = %s%s", name.c_str(), value.expression.c_str(),
+				value.hasValue ? value.value.c_str() : "NULL", fresh ? "" : " \ar(stale)\ax");
+		});
+		return;
+	}
+
+	if (ci_equals(szCharacter, "drop"))
+	{
+		GetArg(szCharacter, szLine, 2);
+		if (szCharacter[0] == 0)
+		{
+			WriteChatf(PLUGIN_MSG "Syntax: /rcobserve drop <character> [expression]");
+			return;
+		}
+
+		observers.Forget(*gChannels, szCharacter, GetNextArg(szLine, 2));
+		return;
+	}
+
+	std::string_view expression = GetNextArg(szLine, 1);
+	if (expression.empty())
+	{
+		WriteChatf(PLUGIN_MSG "Syntax: /rcobserve <character> <expression> | drop <character> [expression]");
+		return;
+	}
+
+	if (IsLocalCharacter(szCharacter))
+	{
+		WriteChatf(PLUGIN_MSG "Our own values can be read directly.");
+		return;
+	}
+
+	// characters on other servers can't be reached, so the server channel is enough
+	Channel* channel = gChannels->GetServerChannel() ? gChannels->GetServerChannel() : gChannels->GetGlobalChannel();
+	if (channel)
+	{
+		observers.Observe(channel->GetHandle(), szCharacter, expression);
+	}
+}
+
+// Everything the channels table shows for one channel, kept as text so a frame only draws strings.
+// The names and help are rebuilt when channels open or close, the numbers once per refresh.
+struct ChannelPanelRow
+{
+	ChannelHandle handle;
+	std::string name;
+	std::string help;
+	bool canLeave = false;
+
+	// counters at the last refresh, the rates are taken from them
+	uint64_t messagesIn = 0;
+	uint64_t messagesOut = 0;
+
+	std::string members;
+	std::string latency;
+	std::string queued;
+	std::string throttled;
+	std::string rates;
+	std::string bytes;
+	std::string failures;
+	std::string lastSender;
+};
+
+constexpr std::chrono::milliseconds PANEL_REFRESH_MILLISECONDS{ 1000 };
+
+static std::string FormatBytes(uint64_t bytes)
+{
+	if (bytes < 1024)
+		return fmt::format("{} B", bytes);
+	if (bytes < 1024 * 1024)
+		return fmt::format("{:.1f} KB", bytes / 1024.0);
+	return fmt::format("{:.1f} MB", bytes / (1024.0 * 1024.0));
+}
+
+static void RefreshChannelRow(ChannelPanelRow& row, const Channel& channel, double seconds)
+{
+	const ChannelTraffic& traffic = channel.GetTraffic();
+	const uint64_t messagesIn = ChannelTraffic::Read(traffic.messagesIn);
+	const uint64_t messagesOut = ChannelTraffic::Read(traffic.messagesOut);
+
+	row.rates = seconds > 0
+		? fmt::format("{:.1f} / {:.1f}", (messagesIn - row.messagesIn) / seconds, (messagesOut - row.messagesOut) / seconds)
+		: std::string("- / -");
+	row.messagesIn = messagesIn;
+	row.messagesOut = messagesOut;
+
+	row.bytes = fmt::format("{} / {}", FormatBytes(ChannelTraffic::Read(traffic.bytesIn)), FormatBytes(ChannelTraffic::Read(traffic.bytesOut)));
+	row.failures = std::to_string(ChannelTraffic::Read(traffic.failures));
+	row.lastSender = traffic.lastSender;
+	row.members = std::to_string(channel.GetMemberCount());
+
+	const ChannelStats& stats = channel.GetStats();
+	row.latency.clear();
+	row.queued.clear();
+	if (stats.delivery.GetCount() > 0)
+	{
+		row.latency = fmt::format("{:.1f} / {:.1f} ms", stats.delivery.Percentile(50).count() / 1000.0, stats.delivery.Percentile(99).count() / 1000.0);
+		row.queued = fmt::format("queued {:.1f} / {:.1f} ms", stats.queued.Percentile(50).count() / 1000.0, stats.queued.Percentile(99).count() / 1000.0);
+	}
+
+	row.throttled.clear();
+	for (Lane lane : { Lane::Urgent, Lane::Bulk })
+	{
+		const LaneStats& laneStats = stats.GetLane(lane);
+		const uint64_t dropped = laneStats.dropped + laneStats.refused;
+		if (laneStats.throttled > 0 || dropped > 0)
+		{
+			if (!row.throttled.empty())
+				row.throttled.append("\n");
+			row.throttled.append(fmt::format("{} {} / {}", lane == Lane::Urgent ? "urgent" : "bulk", laneStats.throttled, dropped));
+		}
+	}
+}
+
+static void RebuildChannelRows(std::vector<ChannelPanelRow>& rows)
+{
+	rows.clear();
+
+	auto addRow = [&](ChannelHandle handle, std::string help, bool canLeave) {
+		const Channel* channel = gChannels->GetChannel(handle);
+		if (!channel)
+			return;
+
+		ChannelPanelRow& row = rows.emplace_back();
+		row.handle = handle;
+		row.name = channel->GetDnsName();
+		row.help = std::move(help);
+		row.canLeave = canLeave;
+
+		// the rates start from now rather than from the channel's whole lifetime
+		RefreshChannelRow(row, *channel, 0);
+	};
+
+	addRow(ChannelHandle::Global, std::string(GLOBAL_HELP), false);
+	addRow(ChannelHandle::Server, std::string(SERVER_HELP), false);
+	addRow(ChannelHandle::Group, std::string(GROUP_HELP), false);
+	addRow(ChannelHandle::Raid, std::string(RAID_HELP), false);
+	addRow(ChannelHandle::Zone, std::string(ZONE_HELP), false);
+
+	std::string topicHelp(TOPIC_HELP);
+	for (const std::string& pattern : gChannels->GetTopics().GetPatterns())
+	{
+		topicHelp.append("\nsubscribed: ").append(pattern);
+	}
+	addRow(ChannelHandle::Topic, std::move(topicHelp), false);
+
+	for (size_t i = static_cast<size_t>(ChannelHandle::FirstCustom); i < gChannels->GetHandleCount(); ++i)
+	{
+		auto handle = static_cast<ChannelHandle>(i);
+		std::string_view name = gChannels->GetChannelName(handle);
+		addRow(handle, fmt::format("/rc [+self] [!]{} <message>\n/rc {} <character> <message>", name, name), true);
+	}
+}
+
+static void DrawText(const std::string& text)
+{
+	ImGui::TextUnformatted(text.data(), text.data() + text.size());
+}
+
+static bool DrawCustomChannelRow(const Channel& channel, const ChannelPanelRow& row)
 {
 	bool erase_this = false;
-	std::string_view dnsName = channel.GetDnsName();
 
 	ImGui::PushID(&channel);
 
@@ -137,16 +474,40 @@ static bool DrawCustomChannelRow(const Channel& channel, const std::string_view&
 
 	// Column 0: Channel name
 	ImGui::TableNextColumn();
-	ImGui::TextUnformatted(dnsName.data(), dnsName.data() + dnsName.size());
+	DrawText(row.name);
 
 	// Column 1: Command help
 	ImGui::TableNextColumn();
-	ImGui::TextUnformatted(helpText.data(), helpText.data() + helpText.size());
+	DrawText(row.help);
 
+	// Column 2: Members present, listed on hover
 	ImGui::TableNextColumn();
-	if (canLeave)
+	DrawText(row.members);
+	if (ImGui::IsItemHovered())
 	{
-		// Column 2: Action button
+		std::string members = pLocalPlayer ? pLocalPlayer->Name : "";
+		channel.ForEachMember([&](const std::string& name) {
+			members.append("\n").append(name);
+		});
+		ImGui::SetTooltip("%s", members.c_str());
+	}
+
+	// Column 3: Delivery and queue latency
+	ImGui::TableNextColumn();
+	if (!row.latency.empty())
+	{
+		DrawText(row.latency);
+		ImGui::TextDisabled("%s", row.queued.c_str());
+	}
+
+	// Column 4: Flow control counters per lane
+	ImGui::TableNextColumn();
+	DrawText(row.throttled);
+
+	ImGui::TableNextColumn();
+	if (row.canLeave)
+	{
+		// Column 5: Action button
 		if (ImGui::Button("Leave"))
 		{
 			erase_this = true;
@@ -158,15 +519,74 @@ static bool DrawCustomChannelRow(const Channel& channel, const std::string_view&
 	return erase_this;
 }
 
+static void DrawTrafficRow(const ChannelPanelRow& row)
+{
+	ImGui::TableNextRow();
+
+	ImGui::TableNextColumn();
+	DrawText(row.name);
+
+	ImGui::TableNextColumn();
+	DrawText(row.rates);
+
+	ImGui::TableNextColumn();
+	DrawText(row.bytes);
+
+	ImGui::TableNextColumn();
+	DrawText(row.failures);
+
+	ImGui::TableNextColumn();
+	DrawText(row.lastSender);
+
+	ImGui::TableNextColumn();
+	DrawText(row.latency);
+}
+
 static void UpdateLogFlags(Logger::LogFlags flags)
 {
 	gLogger->SetFlags(flags);
-	WritePrivateProfileInt("MQRemote", "LoggingFlags", +flags, INIFileName);
+	gSettings->SetInt("MQRemote", "LoggingFlags", +flags);
+}
+
+static std::string GetLogFilePath()
+{
+	return fmt::format("{}/MQRemote_{}.rclog", gPathLogs, GetCurrentProcessId());
+}
+
+static void UpdateLogFile(bool enabled)
+{
+	gLogger->SetLogFile(enabled ? GetLogFilePath() : std::string());
+	gSettings->SetBool("MQRemote", "LogFile", enabled);
 }
 
 static void DrawSubscriptionsPanel()
 {
 	static char newChannelBuf[128] = "";
+	static std::vector<ChannelPanelRow> rows;
+	static uint32_t rowsGeneration = 0;
+	static std::chrono::steady_clock::time_point lastRefresh;
+
+	const auto now = std::chrono::steady_clock::now();
+	if (rows.empty() || rowsGeneration != gChannels->GetGeneration())
+	{
+		RebuildChannelRows(rows);
+		rowsGeneration = gChannels->GetGeneration();
+		lastRefresh = now;
+	}
+	else if (now - lastRefresh >= PANEL_REFRESH_MILLISECONDS)
+	{
+		const double seconds = std::chrono::duration<double>(now - lastRefresh).count();
+		for (ChannelPanelRow& row : rows)
+		{
+			if (const Channel* channel = gChannels->GetChannel(row.handle))
+			{
+				RefreshChannelRow(row, *channel, seconds);
+			}
+		}
+		lastRefresh = now;
+	}
+
+	std::optional<ChannelHandle> leave;
 
 	using enum Logger::LogFlags;
 	int flags = +gLogger->GetFlags();
@@ -202,6 +622,12 @@ static void DrawSubscriptionsPanel()
 
 	ImGui::Unindent();
 
+	bool logFile = gLogger->HasLogFile();
+	if (ImGui::Checkbox("Write Log File", &logFile))
+	{
+		UpdateLogFile(logFile);
+	}
+
 	ImGui::Separator();
 
 	// --- Add new channel section ---
@@ -223,47 +649,57 @@ static void DrawSubscriptionsPanel()
 	}
 
 	// --- List existing subscriptions ---
-	if (ImGui::BeginTable("channels_table", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_Resizable))
+	if (ImGui::BeginTable("channels_table", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_Resizable))
 	{
 		// Table headers
 		ImGui::TableSetupColumn("Channel", ImGuiTableColumnFlags_WidthFixed, 150.0f);
 		ImGui::TableSetupColumn("Usage", ImGuiTableColumnFlags_WidthStretch, 1.0f);
+		ImGui::TableSetupColumn("Members", ImGuiTableColumnFlags_WidthFixed, 60.0f);
+		ImGui::TableSetupColumn("Latency p50 / p99", ImGuiTableColumnFlags_WidthFixed, 140.0f);
+		ImGui::TableSetupColumn("Throttled / Dropped", ImGuiTableColumnFlags_WidthFixed, 140.0f);
 		ImGui::TableSetupColumn("##Delete", ImGuiTableColumnFlags_WidthFixed, 60.0f);
 		ImGui::TableSetupScrollFreeze(0, 1);
 		ImGui::TableHeadersRow();
 
-		if (gChannels->GetGlobalChannel()) 
-		{
-			DrawCustomChannelRow(*gChannels->GetGlobalChannel(), GLOBAL_HELP);
-		}
-		if (gChannels->GetServerChannel())
-		{
-			DrawCustomChannelRow(*gChannels->GetServerChannel(), SERVER_HELP);
-		}
-		if (gChannels->GetGroupChannel())
-		{
-			DrawCustomChannelRow(*gChannels->GetGroupChannel(), GROUP_HELP);
-		}
-		if (gChannels->GetRaidChannel())
+		for (const ChannelPanelRow& row : rows)
 		{
-			DrawCustomChannelRow(*gChannels->GetRaidChannel(), RAID_HELP);
-		}
-		if (gChannels->GetZoneChannel())
-		{
-			DrawCustomChannelRow(*gChannels->GetZoneChannel(), ZONE_HELP);
+			const Channel* channel = gChannels->GetChannel(row.handle);
+			if (channel && DrawCustomChannelRow(*channel, row))
+			{
+				leave = row.handle;
+			}
 		}
 
-		for (auto it = gChannels->GetCustomChannels().begin(); it != gChannels->GetCustomChannels().end(); )
-		{
-			std::string help = fmt::format("/rc [+self] {} <message>\n/rc {} <character> <message>", it->first, it->first);
+		ImGui::EndTable();
+	}
 
-			if (DrawCustomChannelRow(it->second, help, true))
-				it = gChannels->GetCustomChannels().erase(it);
-			else
-				++it;
+	// --- Live traffic, refreshed with the rows ---
+	if (ImGui::CollapsingHeader("Traffic"))
+	{
+		if (ImGui::BeginTable("traffic_table", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_Resizable))
+		{
+			ImGui::TableSetupColumn("Channel", ImGuiTableColumnFlags_WidthFixed, 150.0f);
+			ImGui::TableSetupColumn("Msgs/s in / out", ImGuiTableColumnFlags_WidthFixed, 110.0f);
+			ImGui::TableSetupColumn("Bytes in / out", ImGuiTableColumnFlags_WidthFixed, 140.0f);
+			ImGui::TableSetupColumn("Failures", ImGuiTableColumnFlags_WidthFixed, 60.0f);
+			ImGui::TableSetupColumn("Last sender", ImGuiTableColumnFlags_WidthStretch, 1.0f);
+			ImGui::TableSetupColumn("p50 / p99", ImGuiTableColumnFlags_WidthFixed, 120.0f);
+			ImGui::TableSetupScrollFreeze(0, 1);
+			ImGui::TableHeadersRow();
+
+			for (const ChannelPanelRow& row : rows)
+			{
+				DrawTrafficRow(row);
+			}
+
+			ImGui::EndTable();
 		}
+	}
 
-		ImGui::EndTable();
+	// removed last so the rows stay valid while drawing
+	if (leave)
+	{
+		gChannels->RemoveChannel(*leave);
 	}
 }
 
@@ -273,30 +709,57 @@ using namespace remote;
 
 PLUGIN_API void InitializePlugin()
 {
+	gSettings = new Settings(INIFileName);
+	gSettings->Load();
+	gSettings->Start();
+
 	gLogger = new Logger();
 
-	int flags = GetPrivateProfileInt("MQRemote", "LoggingFlags", static_cast<int>(Logger::LogFlags::DEFAULT_FLAGS), INIFileName);
+	int flags = gSettings->GetInt("MQRemote", "LoggingFlags", static_cast<int>(Logger::LogFlags::DEFAULT_FLAGS));
 	gLogger->SetFlags(static_cast<Logger::LogFlags>(flags));
+	gLogger->SetRateLimit(gSettings->GetInt("MQRemote", "LogRate", 50));
+	// a budget too small to write anything leaves one message per frame and the ring fills up
+	gLogger->SetBudget(std::chrono::microseconds(std::max(gSettings->GetInt("MQRemote", "LogBudget", 500), 100)));
+	if (gSettings->GetBool("MQRemote", "LogFile", false))
+		gLogger->SetLogFile(GetLogFilePath());
 
-	gChannels = new ChannelManager(gLogger);
+	gChannels = new ChannelManager(gLogger, gSettings);
 	gChannels->Initialize();
 
 	AddCommand("/rc", RcCmd);
 	AddCommand("/rcjoin", RcJoinCmd);
 	AddCommand("/rcleave", RcLeaveCmd);
+	AddCommand("/rcstats", RcStatsCmd);
+	AddCommand("/rccapture", RcCaptureCmd);
+	AddCommand("/rcreplay", RcReplayCmd);
+	AddCommand("/rcobserve", RcObserveCmd);
 
 	AddSettingsPanel("plugins/Remote", DrawSubscriptionsPanel);
+
+	RegisterRemoteType(gChannels);
 }
 
 PLUGIN_API void ShutdownPlugin()
 {
+	UnregisterRemoteType();
+
 	gChannels->Shutdown();
 	delete gChannels;
+
+	gLogger->Flush();
 	delete gLogger;
 
+	// anything still queued is written before the plugin unloads
+	gSettings->Stop();
+	delete gSettings;
+
 	RemoveCommand("/rc");
 	RemoveCommand("/rcjoin");
 	RemoveCommand("/rcleave");
+	RemoveCommand("/rcstats");
+	RemoveCommand("/rccapture");
+	RemoveCommand("/rcreplay");
+	RemoveCommand("/rcobserve");
 
 	RemoveSettingsPanel("plugins/Remote");
 }
@@ -309,6 +772,7 @@ PLUGIN_API void SetGameState(int gameState)
 PLUGIN_API void OnPulse()
 {
 	gChannels->OnPulse();
+	gLogger->Flush();
 }
 
 PLUGIN_API void OnBeginZone()
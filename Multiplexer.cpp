@@ -0,0 +1,132 @@
+#include "Multiplexer.h"
+#include "Channel.h"
+#include "NameHash.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+namespace remote {
+
+using google::protobuf::internal::WireFormatLite;
+
+static constexpr uint32_t ID_TAG = WireFormatLite::MakeTag(
+	proto::remote::Message::kIdFieldNumber, WireFormatLite::WIRETYPE_VARINT);
+static constexpr uint32_t CHANNEL_TAG = WireFormatLite::MakeTag(
+	proto::remote::Message::kChannelFieldNumber, WireFormatLite::WIRETYPE_FIXED32);
+
+uint32_t GetChannelId(std::string_view dnsName)
+{
+	const size_t hash = NameHash()(dnsName);
+	return static_cast<uint32_t>(hash ^ (static_cast<uint64_t>(hash) >> 32));
+}
+
+// Reads the message id and channel id, skipping every other field rather than parsing the message
+static bool PeekRoute(const std::string& payload, uint32_t& id, uint32_t& channel)
+{
+	google::protobuf::io::CodedInputStream input(reinterpret_cast<const uint8_t*>(payload.data()), static_cast<int>(payload.size()));
+
+	bool hasChannel = false;
+	id = 0;
+	while (uint32_t tag = input.ReadTag())
+	{
+		if (tag == ID_TAG)
+		{
+			if (!input.ReadVarint32(&id))
+				return false;
+		}
+		else if (tag == CHANNEL_TAG)
+		{
+			if (!input.ReadLittleEndian32(&channel))
+				return false;
+
+			hasChannel = true;
+		}
+		else if (!WireFormatLite::SkipField(&input, tag))
+		{
+			return false;
+		}
+	}
+
+	return hasChannel;
+}
+
+void Multiplexer::Start(const bool enabled)
+{
+	Stop();
+
+	m_enabled = enabled;
+	if (m_enabled)
+	{
+		++m_registrations;
+		m_dropbox = postoffice::AddActor(std::string(MULTIPLEX_MAILBOX).c_str(),
+			[this](const std::shared_ptr<postoffice::Message>& message) { Receive(message); });
+	}
+}
+
+void Multiplexer::Stop()
+{
+	if (m_enabled)
+	{
+		m_dropbox.Remove();
+		m_routes.clear();
+		m_enabled = false;
+	}
+}
+
+postoffice::DropboxAPI Multiplexer::Attach(Channel* channel, const std::string& dnsName)
+{
+	if (!m_enabled)
+	{
+		++m_registrations;
+		return postoffice::AddActor(dnsName.c_str(), [channel](const std::shared_ptr<postoffice::Message>& message) {
+			channel->ReceivedMessageHandler(message);
+		});
+	}
+
+	// two names of one client sharing an id would need a 32 bit collision, the later one wins
+	m_routes[GetChannelId(dnsName)] = channel;
+	return m_dropbox;
+}
+
+void Multiplexer::Detach(Channel* channel, const std::string& dnsName, postoffice::DropboxAPI& dropbox)
+{
+	if (!m_enabled)
+	{
+		dropbox.Remove();
+		return;
+	}
+
+	auto it = m_routes.find(GetChannelId(dnsName));
+	if (it != m_routes.end() && it->second == channel)
+	{
+		m_routes.erase(it);
+	}
+}
+
+void Multiplexer::Receive(const std::shared_ptr<postoffice::Message>& message)
+{
+	uint32_t id = 0;
+	uint32_t channelId = 0;
+	if (!message->Payload || !PeekRoute(*message->Payload, id, channelId))
+	{
+		++m_unrouted;
+		return;
+	}
+
+	auto it = m_routes.find(channelId);
+	if (it != m_routes.end())
+	{
+		it->second->ReceivedMessageHandler(message);
+		return;
+	}
+
+	++m_unrouted;
+
+	// a personal message waits for a reply, tell the sender right away that we aren't there
+	if (id == proto::remote::MessageId::Personal)
+	{
+		m_dropbox.PostReply(message, std::string(), static_cast<uint8_t>(NOT_JOINED_STATUS));
+	}
+}
+
+} // namespace remote
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "mq/Plugin.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace remote {
+
+class Channel;
+
+// Mailbox every channel shares while multiplexed
+constexpr std::string_view MULTIPLEX_MAILBOX = "mqremote";
+
+// Reply status for a personal message to a channel the receiver hasn't joined. The sender fails
+// the post at once, unlike a post nobody took it isn't retried.
+constexpr int NOT_JOINED_STATUS = 100;
+
+// Identifies a channel in multiplexed messages, a hash of its mailbox name
+uint32_t GetChannelId(std::string_view dnsName);
+
+// Registers the postoffice actors channels receive on. By default each channel registers an actor
+// named after its mailbox. Multiplexed, the client registers one actor for everything: messages
+// carry the id of their channel and are handed to the channel in a local table, so joining or
+// leaving a channel costs no registration. Every client then receives the broadcasts of every
+// channel and drops the ones it isn't in, and all clients must agree on the setting. Presence
+// announcements say which setting the sender has, and joins plus an occasional heartbeat also go
+// to the other mode's mailbox, so a client that disagrees is warned about rather than silently
+// unreachable.
+class Multiplexer
+{
+public:
+	~Multiplexer() { Stop(); }
+
+	// Registers the shared actor when enabled, channels must not be open yet
+	void Start(bool enabled);
+	void Stop();
+
+	bool IsEnabled() const { return m_enabled; }
+	std::string_view GetMailbox(const std::string& dnsName) const { return m_enabled ? MULTIPLEX_MAILBOX : dnsName; }
+
+	// Returns the dropbox the channel sends with, its own or the shared one. A channel attaches
+	// again under its new name when it is rebound and detaches every name it attached.
+	postoffice::DropboxAPI Attach(Channel* channel, const std::string& dnsName);
+	void Detach(Channel* channel, const std::string& dnsName, postoffice::DropboxAPI& dropbox);
+
+	uint64_t GetRegistrations() const { return m_registrations; }
+	uint64_t GetUnrouted() const { return m_unrouted; }
+	size_t GetRouteCount() const { return m_routes.size(); }
+
+private:
+	void Receive(const std::shared_ptr<postoffice::Message>& message);
+
+	bool m_enabled = false;
+	postoffice::DropboxAPI m_dropbox;
+	std::unordered_map<uint32_t, Channel*> m_routes; // by channel id, while multiplexed
+
+	uint64_t m_registrations = 0; // actors registered with the postoffice
+	uint64_t m_unrouted = 0;      // multiplexed messages for channels we aren't in
+};
+
+} // namespace remote
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "mq/Plugin.h"
+
+#include <cctype>
+#include <cstdint>
+#include <string_view>
+
+namespace remote {
+
+// Case insensitive hashing for channel and character names, transparent so lookups can use a string_view
+struct NameHash
+{
+	using is_transparent = void;
+
+	size_t operator()(std::string_view name) const noexcept
+	{
+		// FNV-1a over the lowercased name
+		uint64_t hash = 14695981039346656037ull;
+		for (char ch : name)
+		{
+			hash ^= static_cast<uint8_t>(std::tolower(static_cast<unsigned char>(ch)));
+			hash *= 1099511628211ull;
+		}
+		return static_cast<size_t>(hash);
+	}
+};
+
+struct NameEqual
+{
+	using is_transparent = void;
+
+	bool operator()(std::string_view a, std::string_view b) const noexcept
+	{
+		return mq::ci_equals(a, b);
+	}
+};
+
+} // namespace remote
@@ -0,0 +1,330 @@
+#include "Observers.h"
+#include "ChannelManager.h"
+
+#include <algorithm>
+
+namespace remote {
+
+// FNV-1a, only compared between the two ends of a subscription
+static uint32_t HashValue(std::string_view value)
+{
+	uint32_t hash = 2166136261u;
+	for (char ch : value)
+	{
+		hash = (hash ^ static_cast<uint8_t>(ch)) * 16777619u;
+	}
+	return hash;
+}
+
+void Observers::Observe(ChannelHandle handle, std::string_view character, std::string_view expression)
+{
+	auto it = m_observed.find(character);
+	if (it == m_observed.end())
+	{
+		it = m_observed.emplace(std::string(character), ObservedPeer()).first;
+	}
+
+	ObservedPeer& peer = it->second;
+	peer.handle = handle;
+
+	const bool known = std::any_of(peer.values.begin(), peer.values.end(),
+		[&](const ObservedValue& value) { return ci_equals(value.expression, expression); });
+	if (!known)
+	{
+		peer.values.push_back({ peer.nextId++, std::string(expression) });
+	}
+
+	// the whole list goes out with the next pulse
+	peer.renewAt = {};
+}
+
+void Observers::Forget(ChannelManager& channels, std::string_view character, std::string_view expression)
+{
+	auto it = m_observed.find(character);
+	if (it == m_observed.end())
+		return;
+
+	ObservedPeer& peer = it->second;
+	proto::remote::Message message;
+	message.set_id(proto::remote::MessageId::ObserveUnsubscribe);
+
+	// an unsubscribe without observations drops all of them
+	if (!expression.empty())
+	{
+		auto value = std::find_if(peer.values.begin(), peer.values.end(),
+			[&](const ObservedValue& value) { return ci_equals(value.expression, expression); });
+		if (value == peer.values.end())
+			return;
+
+		message.add_observations()->set_id(value->id);
+		peer.values.erase(value);
+	}
+
+	if (Channel* channel = channels.GetChannel(peer.handle))
+	{
+		channel->PostDirect(it->first, message);
+	}
+
+	if (expression.empty() || peer.values.empty())
+	{
+		m_observed.erase(it);
+	}
+}
+
+void Observers::ForgetAll(ChannelManager& channels)
+{
+	while (!m_observed.empty())
+	{
+		const std::string name = m_observed.begin()->first;
+		Forget(channels, name);
+	}
+}
+
+bool Observers::IsFresh(const ObservedPeer& peer) const
+{
+	return std::chrono::steady_clock::now() - peer.lastHeard < m_options->lease;
+}
+
+const ObservedValue* Observers::Find(std::string_view character, std::string_view expression) const
+{
+	auto it = m_observed.find(character);
+	if (it == m_observed.end() || !IsFresh(it->second))
+		return nullptr;
+
+	for (const ObservedValue& value : it->second.values)
+	{
+		if (ci_equals(value.expression, expression))
+			return value.hasValue ? &value : nullptr;
+	}
+
+	return nullptr;
+}
+
+size_t Observers::GetObservedCount() const
+{
+	size_t count = 0;
+	for (const auto& [_, peer] : m_observed)
+	{
+		count += peer.values.size();
+	}
+	return count;
+}
+
+size_t Observers::GetSubscriptionCount() const
+{
+	size_t count = 0;
+	for (const auto& [_, subscriber] : m_subscribers)
+	{
+		count += subscriber.subscriptions.size();
+	}
+	return count;
+}
+
+void Observers::OnMessage(Channel& channel, const std::string& sender, const proto::remote::Message& msg)
+{
+	switch (msg.id())
+	{
+	case proto::remote::MessageId::ObserveSubscribe:
+		OnSubscribe(channel, sender, msg);
+		break;
+
+	case proto::remote::MessageId::ObserveUnsubscribe:
+		OnUnsubscribe(sender, msg);
+		break;
+
+	case proto::remote::MessageId::ObserveUpdate:
+		OnUpdate(sender, msg);
+		break;
+	}
+}
+
+void Observers::Subscribe(Channel& channel, const std::string& name, ObservedPeer& peer)
+{
+	proto::remote::Message message;
+	message.set_id(proto::remote::MessageId::ObserveSubscribe);
+
+	for (const ObservedValue& value : peer.values)
+	{
+		proto::remote::Observation* observation = message.add_observations();
+		observation->set_id(value.id);
+		observation->set_expression(value.expression);
+		if (value.hasValue)
+		{
+			observation->set_valuehash(HashValue(value.value));
+		}
+	}
+
+	channel.PostDirect(name, message);
+}
+
+void Observers::OnSubscribe(Channel& channel, const std::string& sender, const proto::remote::Message& msg)
+{
+	if (msg.observations_size() == 0)
+	{
+		m_subscribers.erase(sender);
+		return;
+	}
+
+	Subscriber& subscriber = m_subscribers[sender];
+	subscriber.handle = channel.GetHandle();
+	subscriber.leaseUntil = std::chrono::steady_clock::now() + m_options->lease;
+	subscriber.pendingReply = true;
+
+	// the list replaces the previous one. A value the observer already holds isn't sent again,
+	// anything else is sent in full.
+	std::vector<Subscription> subscriptions;
+	subscriptions.reserve(msg.observations_size());
+	for (const proto::remote::Observation& observation : msg.observations())
+	{
+		Subscription subscription{ observation.id(), observation.expression() };
+
+		auto previous = std::find_if(subscriber.subscriptions.begin(), subscriber.subscriptions.end(),
+			[&](const Subscription& other) { return other.id == observation.id() && other.expression == observation.expression(); });
+		if (previous != subscriber.subscriptions.end() && previous->sent && observation.has_valuehash()
+			&& observation.valuehash() == HashValue(previous->value))
+		{
+			subscription.value = std::move(previous->value);
+			subscription.sent = true;
+		}
+
+		subscriptions.push_back(std::move(subscription));
+	}
+
+	subscriber.subscriptions = std::move(subscriptions);
+}
+
+void Observers::OnUnsubscribe(const std::string& sender, const proto::remote::Message& msg)
+{
+	auto it = m_subscribers.find(sender);
+	if (it == m_subscribers.end())
+		return;
+
+	std::vector<Subscription>& subscriptions = it->second.subscriptions;
+	for (const proto::remote::Observation& observation : msg.observations())
+	{
+		std::erase_if(subscriptions, [&](const Subscription& subscription) { return subscription.id == observation.id(); });
+	}
+
+	if (msg.observations_size() == 0 || subscriptions.empty())
+	{
+		m_subscribers.erase(it);
+	}
+}
+
+void Observers::OnUpdate(const std::string& sender, const proto::remote::Message& msg)
+{
+	auto it = m_observed.find(sender);
+	if (it == m_observed.end())
+		return;
+
+	ObservedPeer& peer = it->second;
+	peer.lastHeard = std::chrono::steady_clock::now();
+
+	for (const proto::remote::Observation& observation : msg.observations())
+	{
+		auto value = std::find_if(peer.values.begin(), peer.values.end(),
+			[&](const ObservedValue& value) { return value.id == observation.id(); });
+		if (value == peer.values.end())
+			continue;
+
+		// a prefix that doesn't fit is caught by the hash on the next renewal
+		value->value.resize(std::min<size_t>(observation.prefix(), value->value.size()));
+		value->value.append(observation.value());
+		value->hasValue = true;
+	}
+}
+
+const std::string& Observers::Evaluate(const std::string& expression)
+{
+	auto [it, inserted] = m_evaluated.try_emplace(expression);
+	if (inserted)
+	{
+		char buffer[MAX_STRING] = {};
+		snprintf(buffer, sizeof(buffer), "${%s}", expression.c_str());
+		ParseMacroData(buffer, sizeof(buffer));
+		it->second = buffer;
+	}
+
+	return it->second;
+}
+
+void Observers::PostUpdates(ChannelManager& channels)
+{
+	m_evaluated.clear();
+
+	for (auto& [name, subscriber] : m_subscribers)
+	{
+		Channel* channel = channels.GetChannel(subscriber.handle);
+		if (!channel)
+			continue;
+
+		proto::remote::Message message;
+		message.set_id(proto::remote::MessageId::ObserveUpdate);
+
+		for (Subscription& subscription : subscriber.subscriptions)
+		{
+			const std::string& value = Evaluate(subscription.expression);
+			if (subscription.sent && value == subscription.value)
+				continue;
+
+			// only the part after what the value shares with the last one sent
+			size_t prefix = 0;
+			if (subscription.sent)
+			{
+				prefix = std::mismatch(value.begin(), value.end(), subscription.value.begin(), subscription.value.end()).first - value.begin();
+			}
+
+			proto::remote::Observation* observation = message.add_observations();
+			observation->set_id(subscription.id);
+			if (prefix > 0)
+			{
+				observation->set_prefix(static_cast<uint32_t>(prefix));
+			}
+			observation->set_value(value.data() + prefix, value.size() - prefix);
+
+			subscription.value = value;
+			subscription.sent = true;
+			m_bytesSaved += prefix;
+			++m_valuesSent;
+		}
+
+		if (message.observations_size() == 0 && !subscriber.pendingReply)
+			continue;
+
+		subscriber.pendingReply = false;
+		channel->PostDirect(name, message);
+		++m_updatesSent;
+	}
+}
+
+void Observers::OnPulse(ChannelManager& channels, const bool inGame)
+{
+	const auto now = std::chrono::steady_clock::now();
+
+	for (auto& [name, peer] : m_observed)
+	{
+		if (now < peer.renewAt)
+			continue;
+
+		// a closed channel is tried again once it is back
+		Channel* channel = channels.GetChannel(peer.handle);
+		if (!channel)
+			continue;
+
+		Subscribe(*channel, name, peer);
+		peer.renewAt = now + m_options->lease / 2;
+	}
+
+	// subscribers that stopped renewing are gone, as are those on a channel we left
+	std::erase_if(m_subscribers, [&](const auto& entry) {
+		return entry.second.leaseUntil < now || !channels.GetChannel(entry.second.handle);
+	});
+
+	if (inGame && !m_subscribers.empty() && now >= m_nextEvaluation)
+	{
+		m_nextEvaluation = now + m_options->interval;
+		PostUpdates(channels);
+	}
+}
+
+} // namespace remote
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Channel.h"
+#include "NameHash.h"
+#include "Remote.pb.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace remote {
+
+class ChannelManager;
+
+struct ObserverOptions
+{
+	std::chrono::milliseconds interval{ 250 }; // how often observed values are evaluated
+	std::chrono::milliseconds lease{ 10000 };  // a subscription not renewed by then is dropped
+};
+
+// A value we observe on another character
+struct ObservedValue
+{
+	uint32_t id = 0;
+	std::string expression;
+	std::string value;
+	bool hasValue = false;
+};
+
+// Push based observation of TLO values on other characters, in both directions.
+//
+// An observer posts the expressions it wants to the observed character, and renews them every
+// half lease. The observed character evaluates each expression once per interval, however many
+// subscribers share it, and posts each subscriber a single update with only the values that
+// changed. Values are sent as the part after the prefix they share with the previous value. A
+// renewal carries a hash of every value the observer holds, so a lost update or a restart on
+// either side is answered with the full value.
+class Observers
+{
+public:
+	explicit Observers(const ObserverOptions* options)
+		: m_options(options)
+	{
+	}
+
+	// observer side
+	void Observe(ChannelHandle handle, std::string_view character, std::string_view expression);
+	void Forget(ChannelManager& channels, std::string_view character, std::string_view expression = {});
+	void ForgetAll(ChannelManager& channels);
+
+	// Returns the value last received, null if none was or the character hasn't been heard from for a lease
+	const ObservedValue* Find(std::string_view character, std::string_view expression) const;
+
+	template <typename Func>
+	void ForEachObserved(Func&& func) const
+	{
+		for (const auto& [name, peer] : m_observed)
+		{
+			for (const ObservedValue& value : peer.values)
+			{
+				func(name, value, IsFresh(peer));
+			}
+		}
+	}
+
+	// Called by the channel for observe messages
+	void OnMessage(Channel& channel, const std::string& sender, const proto::remote::Message& msg);
+
+	// Renews subscriptions, evaluates observed expressions and posts updates
+	void OnPulse(ChannelManager& channels, bool inGame);
+
+	size_t GetObservedCount() const;
+	size_t GetSubscriberCount() const { return m_subscribers.size(); }
+	size_t GetSubscriptionCount() const;
+	uint64_t GetUpdatesSent() const { return m_updatesSent; }
+	uint64_t GetValuesSent() const { return m_valuesSent; }
+	uint64_t GetBytesSaved() const { return m_bytesSaved; }
+
+private:
+	// a character we observe
+	struct ObservedPeer
+	{
+		ChannelHandle handle = ChannelHandle::Invalid;
+		std::vector<ObservedValue> values;
+		uint32_t nextId = 1;
+		std::chrono::steady_clock::time_point lastHeard;
+		std::chrono::steady_clock::time_point renewAt;
+	};
+
+	// a character observing us
+	struct Subscription
+	{
+		uint32_t id = 0;
+		std::string expression;
+		std::string value; // as last sent
+		bool sent = false;
+	};
+
+	struct Subscriber
+	{
+		ChannelHandle handle = ChannelHandle::Invalid;
+		std::vector<Subscription> subscriptions;
+		std::chrono::steady_clock::time_point leaseUntil;
+		bool pendingReply = false; // a renewal is answered even if nothing changed
+	};
+
+	bool IsFresh(const ObservedPeer& peer) const;
+	void Subscribe(Channel& channel, const std::string& name, ObservedPeer& peer);
+	void OnSubscribe(Channel& channel, const std::string& sender, const proto::remote::Message& msg);
+	void OnUnsubscribe(const std::string& sender, const proto::remote::Message& msg);
+	void OnUpdate(const std::string& sender, const proto::remote::Message& msg);
+	const std::string& Evaluate(const std::string& expression);
+	void PostUpdates(ChannelManager& channels);
+
+	const ObserverOptions* m_options;
+	std::unordered_map<std::string, ObservedPeer, NameHash, NameEqual> m_observed;
+	std::unordered_map<std::string, Subscriber, NameHash, NameEqual> m_subscribers;
+	std::chrono::steady_clock::time_point m_nextEvaluation;
+
+	// values evaluated this interval, shared by every subscriber of an expression
+	std::unordered_map<std::string, std::string> m_evaluated;
+
+	uint64_t m_updatesSent = 0;
+	uint64_t m_valuesSent = 0;
+	uint64_t m_bytesSaved = 0; // value bytes left out by sending only what changed
+};
+
+} // namespace remote
@@ -0,0 +1,141 @@
+#include "ReceivePipeline.h"
+#include "CommandDictionary.h"
+
+#include <chrono>
+
+namespace remote {
+
+// how long the worker waits for the game thread to make room before trying again
+static constexpr std::chrono::milliseconds FULL_RETRY_DELAY{ 1 };
+
+void ReceivePipeline::Start(const size_t capacity)
+{
+	Stop();
+
+	m_incoming = std::make_unique<SpscQueue<ReceivedMessage>>(capacity);
+	m_decoded = std::make_unique<SpscQueue<ReceivedMessage>>(capacity);
+	m_stopping = false;
+	m_worker = std::thread([this]() { Run(); });
+}
+
+void ReceivePipeline::Stop()
+{
+	if (!m_worker.joinable())
+		return;
+
+	m_stopping.store(true, std::memory_order_release);
+	Wake();
+	m_worker.join();
+
+	m_incoming.reset();
+	m_decoded.reset();
+	m_overflow.clear();
+}
+
+bool ReceivePipeline::Submit(const std::weak_ptr<Channel*>& channel, const std::shared_ptr<postoffice::Message>& message)
+{
+	if (!m_worker.joinable())
+		return false;
+
+	ReceivedMessage received;
+	received.channel = channel;
+	received.message = message;
+
+	// nothing may overtake the messages already waiting for room
+	if (!m_overflow.empty() || !m_incoming->TryPush(std::move(received)))
+	{
+		m_overflow.push_back(std::move(received));
+		++m_overflowed;
+		return true;
+	}
+
+	++m_submitted;
+	Wake();
+	return true;
+}
+
+void ReceivePipeline::SubmitOverflow()
+{
+	size_t submitted = 0;
+	while (!m_overflow.empty() && m_incoming->TryPush(std::move(m_overflow.front())))
+	{
+		m_overflow.pop_front();
+		++submitted;
+	}
+
+	if (submitted > 0)
+	{
+		m_submitted += submitted;
+		Wake();
+	}
+}
+
+void ReceivePipeline::Wake()
+{
+	m_wake.fetch_add(1, std::memory_order_release);
+	m_wake.notify_one();
+}
+
+void ReceivePipeline::Decode(ReceivedMessage& received)
+{
+	static const DWORD processId = GetCurrentProcessId();
+
+	// telling our own messages apart by character name needs the game, that is left to the game thread
+	const postoffice::Message& message = *received.message;
+	if (message.Sender && message.Sender->PID && *message.Sender->PID == processId)
+	{
+		received.echo = true;
+		return;
+	}
+
+	Parse(received);
+}
+
+void ReceivePipeline::Parse(ReceivedMessage& received)
+{
+	const postoffice::Message& message = *received.message;
+	proto::remote::Message& msg = received.decoded;
+	received.parsed = message.Payload && msg.ParseFromString(*message.Payload);
+	if (!received.parsed || msg.prefixes_size() == 0 || msg.dictionary() != COMMAND_DICTIONARY_VERSION)
+		return;
+
+	// commands arrive with their dictionary prefixes put back
+	if (msg.commands_size() == 0)
+	{
+		msg.mutable_command()->insert(0, GetCommandPrefix(msg.prefixes(0)));
+	}
+	else
+	{
+		for (int i = 0; i < msg.commands_size() && i < msg.prefixes_size(); ++i)
+		{
+			msg.mutable_commands(i)->insert(0, GetCommandPrefix(msg.prefixes(i)));
+		}
+	}
+	msg.clear_prefixes();
+}
+
+void ReceivePipeline::Run()
+{
+	ReceivedMessage received;
+	while (!m_stopping.load(std::memory_order_acquire))
+	{
+		const uint32_t wake = m_wake.load(std::memory_order_acquire);
+		while (m_incoming->TryPop(received))
+		{
+			Decode(received);
+
+			// the game thread drains once a pulse, wait for room rather than lose the message
+			while (!m_decoded->TryPush(std::move(received)))
+			{
+				if (m_stopping.load(std::memory_order_acquire))
+					return;
+
+				std::this_thread::sleep_for(FULL_RETRY_DELAY);
+			}
+		}
+
+		m_wake.wait(wake, std::memory_order_acquire);
+	}
+}
+
+} // namespace remote
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Remote.pb.h"
+#include "SpscQueue.h"
+#include "mq/Plugin.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+
+namespace remote {
+
+class Channel;
+
+// A message delivered to a channel's mailbox, decoded by the pipeline's worker
+struct ReceivedMessage
+{
+	std::weak_ptr<Channel*> channel; // expires once the channel is closed
+	std::shared_ptr<postoffice::Message> message;
+	proto::remote::Message decoded;
+	bool echo = false;   // carries our process id, left undecoded for the game thread to check
+	bool parsed = false;
+};
+
+// Decodes received messages on a worker thread. Mailboxes hand their messages over as they arrive,
+// the worker parses them, sets aside what may be our own echoes and expands dictionary encoded commands, and the
+// game thread picks up the results from ChannelManager::OnPulse. Both hand overs are lock-free
+// single producer, single consumer queues.
+class ReceivePipeline
+{
+public:
+	~ReceivePipeline() { Stop(); }
+
+	void Start(size_t capacity);
+
+	// Waits for the worker to finish, messages it still holds are dropped
+	void Stop();
+
+	bool IsRunning() const { return m_worker.joinable(); }
+
+	// Game thread. Returns false if the pipeline isn't running, the caller then decodes the message
+	// itself. While the queue is full messages wait on the game thread behind it, so they are still
+	// handed back in the order they arrived.
+	bool Submit(const std::weak_ptr<Channel*>& channel, const std::shared_ptr<postoffice::Message>& message);
+
+	// Game thread. Calls func with every decoded message, in the order they were submitted.
+	template <typename Func>
+	size_t Drain(Func&& func)
+	{
+		if (!m_decoded)
+			return 0;
+
+		size_t count = 0;
+		while (m_decoded->TryPop(m_draining))
+		{
+			func(m_draining);
+			++count;
+		}
+
+		// the worker may have been waiting for the room just made
+		SubmitOverflow();
+
+		m_drained += count;
+		return count;
+	}
+
+	uint64_t GetSubmitted() const { return m_submitted; }
+	uint64_t GetDrained() const { return m_drained; }
+	uint64_t GetOverflowed() const { return m_overflowed; }
+	size_t GetBacklog() const { return m_incoming ? m_incoming->GetSize() + m_decoded->GetSize() + m_overflow.size() : 0; }
+
+	// Parses and expands a message the way the worker does
+	static void Decode(ReceivedMessage& received);
+
+	// Decode without the echo check, for a message that carried our process id but isn't ours
+	static void Parse(ReceivedMessage& received);
+
+private:
+	void Run();
+	void SubmitOverflow();
+	void Wake();
+
+	std::unique_ptr<SpscQueue<ReceivedMessage>> m_incoming; // game thread to worker
+	std::unique_ptr<SpscQueue<ReceivedMessage>> m_decoded;  // worker to game thread
+	std::thread m_worker;
+	std::atomic<bool> m_stopping{ false };
+	std::atomic<uint32_t> m_wake{ 0 }; // bumped for every submitted message, the worker sleeps on it
+
+	ReceivedMessage m_draining; // reused so draining doesn't allocate
+	std::deque<ReceivedMessage> m_overflow; // game thread, submitted while the queue was full
+
+	uint64_t m_submitted = 0;
+	uint64_t m_drained = 0;
+	uint64_t m_overflowed = 0; // held on the game thread because the queue was full
+};
+
+} // namespace remote
@@ -0,0 +1,279 @@
+#include "RemoteType.h"
+#include "ChannelManager.h"
+
+#include "mq/Plugin.h"
+
+namespace remote {
+
+static ChannelManager* s_channels = nullptr;
+
+static float ToMilliseconds(std::chrono::microseconds value)
+{
+	return static_cast<float>(value.count()) / 1000.0f;
+}
+
+// ${Remote.Channel[name]}, the value is the channel handle so it stays valid while the
+// channel is reopened
+class MQ2RemoteChannelType : public MQ2Type
+{
+public:
+	enum class Members
+	{
+		Name,
+		Delivery,
+		DeliveryP99,
+		Queued,
+		QueuedP99,
+		PeerDelivery,
+		PeerDeliveryP99,
+		PeerQueued,
+		PeerGaps,
+		ClockOffset,
+		Coalesced,
+		Members,
+		Member,
+		MemberList,
+	};
+
+	MQ2RemoteChannelType() : MQ2Type("RemoteChannel")
+	{
+		ScopedTypeMember(Members, Name);
+		ScopedTypeMember(Members, Delivery);
+		ScopedTypeMember(Members, DeliveryP99);
+		ScopedTypeMember(Members, Queued);
+		ScopedTypeMember(Members, QueuedP99);
+		ScopedTypeMember(Members, PeerDelivery);
+		ScopedTypeMember(Members, PeerDeliveryP99);
+		ScopedTypeMember(Members, PeerQueued);
+		ScopedTypeMember(Members, PeerGaps);
+		ScopedTypeMember(Members, ClockOffset);
+		ScopedTypeMember(Members, Coalesced);
+		ScopedTypeMember(Members, Members);
+		ScopedTypeMember(Members, Member);
+		ScopedTypeMember(Members, MemberList);
+	}
+
+	bool GetMember(MQVarPtr VarPtr, const char* Member, char* Index, MQTypeVar& Dest) override
+	{
+		MQTypeMember* pMember = FindMember(Member);
+		if (!pMember)
+			return false;
+
+		Channel* channel = s_channels->GetChannel(static_cast<ChannelHandle>(VarPtr.Int));
+		if (!channel)
+			return false;
+
+		const ChannelStats& stats = channel->GetStats();
+		const PeerInfo* peer = Index && Index[0] ? channel->FindPeer(Index) : nullptr;
+
+		switch (static_cast<Members>(pMember->ID))
+		{
+		case Members::Name:
+			strcpy_s(DataTypeTemp, MAX_STRING, channel->GetDnsName().data());
+			Dest.Ptr = &DataTypeTemp[0];
+			Dest.Type = datatypes::pStringType;
+			return true;
+
+		case Members::Delivery:
+			Dest.Float = ToMilliseconds(stats.delivery.Percentile(50));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::DeliveryP99:
+			Dest.Float = ToMilliseconds(stats.delivery.Percentile(99));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::Queued:
+			Dest.Float = ToMilliseconds(stats.queued.Percentile(50));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::QueuedP99:
+			Dest.Float = ToMilliseconds(stats.queued.Percentile(99));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::PeerDelivery:
+			if (!peer)
+				return false;
+			Dest.Float = ToMilliseconds(peer->delivery.Percentile(50));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::PeerDeliveryP99:
+			if (!peer)
+				return false;
+			Dest.Float = ToMilliseconds(peer->delivery.Percentile(99));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::PeerQueued:
+			if (!peer)
+				return false;
+			Dest.Float = ToMilliseconds(peer->queued.Percentile(50));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::PeerGaps:
+			if (!peer)
+				return false;
+			Dest.Int64 = static_cast<int64_t>(peer->gaps);
+			Dest.Type = datatypes::pInt64Type;
+			return true;
+
+		case Members::ClockOffset:
+			if (!Index || !Index[0] || !s_channels->GetClockSync().HasOffset(Index))
+				return false;
+			Dest.Float = ToMilliseconds(std::chrono::microseconds(s_channels->GetClockSync().GetOffset(Index)));
+			Dest.Type = datatypes::pFloatType;
+			return true;
+
+		case Members::Coalesced:
+			Dest.Int64 = static_cast<int64_t>(stats.coalesced);
+			Dest.Type = datatypes::pInt64Type;
+			return true;
+
+		case Members::Members:
+			Dest.Int = static_cast<int>(channel->GetMemberCount());
+			Dest.Type = datatypes::pIntType;
+			return true;
+
+		case Members::Member:
+			if (!Index || !Index[0])
+				return false;
+			Dest.Set(channel->IsMember(Index));
+			Dest.Type = datatypes::pBoolType;
+			return true;
+
+		case Members::MemberList:
+		{
+			// ourselves first, then everyone else present
+			std::string list = pLocalPlayer ? pLocalPlayer->Name : "";
+			channel->ForEachMember([&](const std::string& name) {
+				if (!list.empty())
+				{
+					list += ',';
+				}
+				list += name;
+			});
+			strcpy_s(DataTypeTemp, MAX_STRING, list.substr(0, MAX_STRING - 1).c_str());
+			Dest.Ptr = &DataTypeTemp[0];
+			Dest.Type = datatypes::pStringType;
+			return true;
+		}
+		}
+
+		return false;
+	}
+
+	bool ToString(MQVarPtr VarPtr, char* Destination) override
+	{
+		Channel* channel = s_channels->GetChannel(static_cast<ChannelHandle>(VarPtr.Int));
+		if (!channel)
+			return false;
+
+		strcpy_s(Destination, MAX_STRING, channel->GetDnsName().data());
+		return true;
+	}
+};
+
+// ${Remote}
+class MQ2RemoteType : public MQ2Type
+{
+public:
+	enum class Members
+	{
+		Channel,
+		Observed,
+	};
+
+	MQ2RemoteType() : MQ2Type("Remote")
+	{
+		ScopedTypeMember(Members, Channel);
+		ScopedTypeMember(Members, Observed);
+	}
+
+	bool GetMember(MQVarPtr VarPtr, const char* Member, char* Index, MQTypeVar& Dest) override;
+
+	bool ToString(MQVarPtr VarPtr, char* Destination) override
+	{
+		strcpy_s(Destination, MAX_STRING, "Remote");
+		return true;
+	}
+};
+
+static MQ2RemoteType* pRemoteType = nullptr;
+static MQ2RemoteChannelType* pRemoteChannelType = nullptr;
+
+bool MQ2RemoteType::GetMember(MQVarPtr VarPtr, const char* Member, char* Index, MQTypeVar& Dest)
+{
+	MQTypeMember* pMember = FindMember(Member);
+	if (!pMember)
+		return false;
+
+	switch (static_cast<Members>(pMember->ID))
+	{
+	case Members::Channel:
+		{
+			if (!Index || !Index[0])
+				return false;
+
+			ChannelHandle handle = s_channels->FindHandle(Index);
+			if (!s_channels->GetChannel(handle))
+				return false;
+
+			Dest.Int = static_cast<int>(handle);
+			Dest.Type = pRemoteChannelType;
+			return true;
+		}
+
+	case Members::Observed:
+		{
+			// [character,expression], the expression may contain commas of its own
+			std::string_view index = Index ? Index : "";
+			const size_t comma = index.find(',');
+			if (comma == std::string_view::npos)
+				return false;
+
+			const ObservedValue* value = s_channels->GetObservers().Find(trim(index.substr(0, comma)), trim(index.substr(comma + 1)));
+			if (!value)
+				return false;
+
+			strcpy_s(DataTypeTemp, MAX_STRING, value->value.c_str());
+			Dest.Ptr = &DataTypeTemp[0];
+			Dest.Type = datatypes::pStringType;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool dataRemote(const char*, MQTypeVar& Ret)
+{
+	Ret.Type = pRemoteType;
+	return true;
+}
+
+void RegisterRemoteType(ChannelManager* channels)
+{
+	s_channels = channels;
+	pRemoteType = new MQ2RemoteType();
+	pRemoteChannelType = new MQ2RemoteChannelType();
+
+	AddTopLevelObject("Remote", dataRemote);
+}
+
+void UnregisterRemoteType()
+{
+	RemoveTopLevelObject("Remote");
+
+	delete pRemoteChannelType;
+	delete pRemoteType;
+	pRemoteChannelType = nullptr;
+	pRemoteType = nullptr;
+	s_channels = nullptr;
+}
+
+} // namespace remote
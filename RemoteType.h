@@ -0,0 +1,11 @@
+#pragma once
+
+namespace remote {
+
+class ChannelManager;
+
+// Registers the ${Remote} top level object, also reachable from Lua as mq.TLO.Remote
+void RegisterRemoteType(ChannelManager* channels);
+void UnregisterRemoteType();
+
+} // namespace remote
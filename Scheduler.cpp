@@ -0,0 +1,105 @@
+#include "Scheduler.h"
+#include "ClockSync.h"
+#include "CommandArgs.h"
+
+#include <algorithm>
+
+namespace remote {
+
+// runs reported later than this after the target aren't waited for
+static constexpr int64_t REPORT_WINDOW_MICROS = 5000000;
+
+void Scheduler::Schedule(int64_t runAt, QueuedCommand&& command)
+{
+	++m_scheduled;
+
+	// a bad clock estimate can't hold a command for longer than a sender could ask for
+	const int64_t now = WallClockMicros();
+	runAt = std::min<int64_t>(runAt, now + std::chrono::duration_cast<std::chrono::microseconds>(MAX_SCHEDULE_DELAY).count());
+	if (runAt <= now)
+	{
+		m_commands->Push(std::move(command));
+		return;
+	}
+
+	// times further out than a turn stay in their slot until the wheel comes around to them
+	m_slots[static_cast<size_t>(runAt / SLOT_MICROS) % SLOT_COUNT].push_back({ runAt, std::move(command) });
+	++m_pending;
+}
+
+void Scheduler::OnPulse()
+{
+	const int64_t now = WallClockMicros();
+	const int64_t tick = now / SLOT_MICROS;
+
+	if (m_pending > 0)
+	{
+		// after a long frame one turn visits every slot. The current slot is visited again next
+		// pulse, it may hold commands due later in this tick.
+		for (int64_t i = std::max(m_tick, tick - static_cast<int64_t>(SLOT_COUNT) + 1); i <= tick; ++i)
+		{
+			std::vector<Entry>& slot = m_slots[static_cast<size_t>(i) % SLOT_COUNT];
+			for (Entry& entry : slot)
+			{
+				if (entry.runAt <= now)
+				{
+					// time spent waiting for its turn isn't queue latency
+					entry.command.queuedAt = std::chrono::steady_clock::now();
+					m_commands->Push(std::move(entry.command));
+				}
+			}
+
+			m_pending -= std::erase_if(slot, [now](const Entry& entry) { return entry.runAt <= now; });
+		}
+	}
+	m_tick = tick;
+
+	while (!m_tracked.empty() && now - m_tracked.front().executeAt > REPORT_WINDOW_MICROS)
+	{
+		const Tracked& tracked = m_tracked.front();
+		if (tracked.runs > 1)
+		{
+			m_lastSpread = std::chrono::microseconds(tracked.last - tracked.first);
+			m_spread.Record(m_lastSpread);
+		}
+		m_tracked.pop_front();
+	}
+}
+
+void Scheduler::Detach(const Channel* channel)
+{
+	for (std::vector<Entry>& slot : m_slots)
+	{
+		for (Entry& entry : slot)
+		{
+			if (entry.command.channel == channel)
+			{
+				entry.command.channel = nullptr;
+			}
+		}
+	}
+}
+
+void Scheduler::Track(const int64_t executeAt)
+{
+	// kept in order of their target, sends with different delays can finish out of order
+	auto it = std::lower_bound(m_tracked.begin(), m_tracked.end(), executeAt,
+		[](const Tracked& tracked, int64_t time) { return tracked.executeAt < time; });
+	if (it == m_tracked.end() || it->executeAt != executeAt)
+	{
+		m_tracked.insert(it, { executeAt });
+	}
+}
+
+void Scheduler::AddExecution(const int64_t executeAt, const int64_t ranAt)
+{
+	auto it = std::find_if(m_tracked.rbegin(), m_tracked.rend(), [&](const Tracked& tracked) { return tracked.executeAt == executeAt; });
+	if (it == m_tracked.rend())
+		return;
+
+	it->first = it->runs == 0 ? ranAt : std::min(it->first, ranAt);
+	it->last = it->runs == 0 ? ranAt : std::max(it->last, ranAt);
+	++it->runs;
+}
+
+} // namespace remote
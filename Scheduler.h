@@ -0,0 +1,82 @@
+#pragma once
+
+#include "CommandQueue.h"
+#include "Histogram.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace remote {
+
+class Channel;
+
+// Commands sent with /rc @+<delay> carry the wall clock time they should run at. Receivers convert
+// it to their own clock with the estimated offset to the sender, see ClockSync, and hold the command
+// in a timer wheel until then. Every receiver reports back when it ran the command, so the sender
+// can measure how far apart the runs ended up.
+class Scheduler
+{
+public:
+	explicit Scheduler(CommandQueue* commands)
+		: m_commands(commands)
+	{
+	}
+
+	// Holds the command until runAt, on our wall clock. A time already past queues it right away.
+	void Schedule(int64_t runAt, QueuedCommand&& command);
+
+	// Queues the commands that are due and finishes spread measurements
+	void OnPulse();
+
+	// Keeps the channel's scheduled commands, but forgets where to report them
+	void Detach(const Channel* channel);
+
+	// Called by the sender for every scheduled send, and for every run reported back to it. Both
+	// times are on our clock.
+	void Track(int64_t executeAt);
+	void AddExecution(int64_t executeAt, int64_t ranAt);
+
+	// Called once a scheduled command ran here
+	void RecordLateness(std::chrono::microseconds lateness) { m_lateness.Record(lateness); }
+
+	size_t GetPending() const { return m_pending; }
+	uint64_t GetScheduled() const { return m_scheduled; }
+	const LatencyHistogram& GetLateness() const { return m_lateness; }
+	const LatencyHistogram& GetSpread() const { return m_spread; }
+	std::chrono::microseconds GetLastSpread() const { return m_lastSpread; }
+
+private:
+	struct Entry
+	{
+		int64_t runAt;
+		QueuedCommand command;
+	};
+
+	// a scheduled send of ours, waiting for the runs to be reported
+	struct Tracked
+	{
+		int64_t executeAt;
+		int64_t first = 0;
+		int64_t last = 0;
+		size_t runs = 0;
+	};
+
+	static constexpr int64_t SLOT_MICROS = 10000; // 10ms per slot
+	static constexpr size_t SLOT_COUNT = 256;     // one turn of the wheel covers 2.56s
+
+	CommandQueue* m_commands;
+	std::array<std::vector<Entry>, SLOT_COUNT> m_slots;
+	int64_t m_tick = 0; // first tick not fully drained
+	size_t m_pending = 0;
+	uint64_t m_scheduled = 0;
+
+	std::deque<Tracked> m_tracked;
+	LatencyHistogram m_lateness; // due until run, for commands run here
+	LatencyHistogram m_spread;   // first until last run of a send, over its receivers
+	std::chrono::microseconds m_lastSpread{ 0 };
+};
+
+} // namespace remote
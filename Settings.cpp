@@ -0,0 +1,380 @@
+#include "Settings.h"
+
+#include <mq/Plugin.h>
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+
+namespace remote {
+
+// how long the writer waits for more changes before writing the file
+static constexpr std::chrono::milliseconds WRITE_DELAY{ 500 };
+
+// how long a write waits for another client to finish writing the file before trying again later
+static constexpr std::chrono::milliseconds FILE_LOCK_TIMEOUT{ 2000 };
+
+// Mutex names can't contain backslashes, every client sharing the file derives the same name from its path
+static std::string GetFileMutexName(std::string_view path)
+{
+	return fmt::format("Local\\MQRemoteSettings-{:016x}", static_cast<uint64_t>(NameHash()(path)));
+}
+
+static std::vector<std::string> ReadLines(const std::string& path)
+{
+	std::vector<std::string> lines;
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		lines.push_back(std::move(line));
+	}
+
+	return lines;
+}
+
+// Returns the section name if the line is a section header
+static std::optional<std::string_view> ParseSection(std::string_view line)
+{
+	line = trim(line);
+	if (line.size() < 2 || line.front() != '[' || line.back() != ']')
+		return std::nullopt;
+
+	return trim(line.substr(1, line.size() - 2));
+}
+
+// Splits a key=value line, comments and blank lines have no key
+static std::optional<std::pair<std::string_view, std::string_view>> ParseEntry(std::string_view line)
+{
+	line = trim(line);
+	if (line.empty() || line.front() == ';' || line.front() == '#')
+		return std::nullopt;
+
+	const size_t equals = line.find('=');
+	if (equals == std::string_view::npos)
+		return std::nullopt;
+
+	return std::make_pair(trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+}
+
+void Settings::Load()
+{
+	m_sections.clear();
+
+	Entries* entries = nullptr;
+	for (const std::string& line : ReadLines(m_path))
+	{
+		if (auto section = ParseSection(line))
+		{
+			entries = &m_sections[std::string(*section)];
+		}
+		else if (auto entry = ParseEntry(line); entry && entries)
+		{
+			auto it = std::find_if(entries->begin(), entries->end(),
+				[&](const auto& existing) { return ci_equals(existing.first, entry->first); });
+			if (it == entries->end())
+			{
+				entries->emplace_back(entry->first, entry->second);
+			}
+		}
+	}
+}
+
+void Settings::Start()
+{
+	if (m_writer.joinable())
+		return;
+
+	m_stopping = false;
+	m_writer = std::thread([this]() { Run(); });
+}
+
+void Settings::Stop()
+{
+	if (m_writer.joinable())
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_one();
+		m_writer.join();
+	}
+
+	// whatever the writer didn't get to, including changes made before it was started
+	std::vector<Change> changes;
+	{
+		std::lock_guard lock(m_mutex);
+		changes.swap(m_pending);
+	}
+
+	if (!changes.empty())
+	{
+		Write(changes);
+	}
+}
+
+const std::string* Settings::Find(std::string_view section, std::string_view key) const
+{
+	auto sectionIt = m_sections.find(section);
+	if (sectionIt == m_sections.end())
+		return nullptr;
+
+	for (const auto& [name, value] : sectionIt->second)
+	{
+		if (ci_equals(name, key))
+			return &value;
+	}
+
+	return nullptr;
+}
+
+std::string Settings::GetString(std::string_view section, std::string_view key, std::string_view defaultValue) const
+{
+	const std::string* value = Find(section, key);
+	return value ? *value : std::string(defaultValue);
+}
+
+int Settings::GetInt(std::string_view section, std::string_view key, int defaultValue) const
+{
+	const std::string* value = Find(section, key);
+	if (!value)
+		return defaultValue;
+
+	int result = defaultValue;
+	std::from_chars(value->data(), value->data() + value->size(), result);
+	return result;
+}
+
+bool Settings::GetBool(std::string_view section, std::string_view key, bool defaultValue) const
+{
+	const std::string* value = Find(section, key);
+	if (!value)
+		return defaultValue;
+
+	if (ci_equals(*value, "true") || ci_equals(*value, "on"))
+		return true;
+
+	int result = 0;
+	std::from_chars(value->data(), value->data() + value->size(), result);
+	return result != 0;
+}
+
+bool Settings::HasKey(std::string_view section, std::string_view key) const
+{
+	return Find(section, key) != nullptr;
+}
+
+std::vector<std::string> Settings::GetKeys(std::string_view section) const
+{
+	std::vector<std::string> keys;
+	auto it = m_sections.find(section);
+	if (it != m_sections.end())
+	{
+		keys.reserve(it->second.size());
+		for (const auto& entry : it->second)
+		{
+			keys.push_back(entry.first);
+		}
+	}
+
+	return keys;
+}
+
+void Settings::SetString(std::string_view section, std::string_view key, std::string_view value)
+{
+	const std::string* existing = Find(section, key);
+	if (existing && *existing == value)
+		return;
+
+	Entries& entries = m_sections[std::string(section)];
+	auto it = std::find_if(entries.begin(), entries.end(),
+		[&](const auto& entry) { return ci_equals(entry.first, key); });
+	if (it != entries.end())
+	{
+		it->second = value;
+	}
+	else
+	{
+		entries.emplace_back(key, value);
+	}
+
+	Queue(section, key, std::string(value));
+}
+
+void Settings::SetInt(std::string_view section, std::string_view key, int value)
+{
+	SetString(section, key, std::to_string(value));
+}
+
+void Settings::SetBool(std::string_view section, std::string_view key, bool value)
+{
+	SetString(section, key, value ? "1" : "0");
+}
+
+void Settings::DeleteKey(std::string_view section, std::string_view key)
+{
+	auto sectionIt = m_sections.find(section);
+	if (sectionIt == m_sections.end())
+		return;
+
+	Entries& entries = sectionIt->second;
+	auto it = std::find_if(entries.begin(), entries.end(),
+		[&](const auto& entry) { return ci_equals(entry.first, key); });
+	if (it == entries.end())
+		return;
+
+	entries.erase(it);
+	Queue(section, key, std::nullopt);
+}
+
+void Settings::Queue(std::string_view section, std::string_view key, std::optional<std::string> value)
+{
+	++m_changes;
+	{
+		std::lock_guard lock(m_mutex);
+		m_pending.push_back({ std::string(section), std::string(key), std::move(value) });
+	}
+	m_wake.notify_one();
+}
+
+void Settings::Run()
+{
+	std::unique_lock lock(m_mutex);
+	while (true)
+	{
+		m_wake.wait(lock, [this]() { return m_stopping || !m_pending.empty(); });
+		if (m_stopping)
+			return; // Stop writes what is left
+
+		// let the rest of a burst arrive so it costs one write
+		m_wake.wait_for(lock, WRITE_DELAY, [this]() { return m_stopping; });
+		if (m_stopping)
+			return;
+
+		std::vector<Change> changes;
+		changes.swap(m_pending);
+
+		lock.unlock();
+		const bool written = Write(changes);
+		lock.lock();
+
+		// the file may be locked by another client, keep the changes for the next attempt
+		if (!written)
+		{
+			m_pending.insert(m_pending.begin(), std::make_move_iterator(changes.begin()), std::make_move_iterator(changes.end()));
+		}
+	}
+}
+
+bool Settings::Write(const std::vector<Change>& changes)
+{
+	HANDLE mutex = CreateMutexA(nullptr, FALSE, GetFileMutexName(m_path).c_str());
+	if (!mutex)
+		return false;
+
+	// a client that died while writing leaves the mutex abandoned, the file itself is still whole
+	const DWORD wait = WaitForSingleObject(mutex, static_cast<DWORD>(FILE_LOCK_TIMEOUT.count()));
+	bool written = false;
+	if (wait == WAIT_OBJECT_0 || wait == WAIT_ABANDONED)
+	{
+		written = MergeAndReplace(changes);
+		ReleaseMutex(mutex);
+	}
+
+	CloseHandle(mutex);
+	return written;
+}
+
+bool Settings::MergeAndReplace(const std::vector<Change>& changes)
+{
+	std::vector<std::string> lines = ReadLines(m_path);
+
+	for (const Change& change : changes)
+	{
+		// find the section, and the key or the end of the section's entries
+		size_t sectionLine = lines.size();
+		size_t insertAt = lines.size();
+		std::optional<size_t> keyLine;
+		for (size_t i = 0; i < lines.size(); ++i)
+		{
+			if (auto section = ParseSection(lines[i]))
+			{
+				if (sectionLine != lines.size())
+					break;
+
+				if (ci_equals(*section, change.section))
+				{
+					sectionLine = i;
+					insertAt = i + 1;
+				}
+			}
+			else if (sectionLine != lines.size())
+			{
+				auto entry = ParseEntry(lines[i]);
+				if (entry && ci_equals(entry->first, change.key))
+				{
+					keyLine = i;
+					break;
+				}
+
+				if (!trim(lines[i]).empty())
+				{
+					insertAt = i + 1;
+				}
+			}
+		}
+
+		std::string line = change.value ? fmt::format("{}={}", change.key, *change.value) : std::string();
+		if (keyLine)
+		{
+			if (change.value)
+				lines[*keyLine] = std::move(line);
+			else
+				lines.erase(lines.begin() + *keyLine);
+		}
+		else if (change.value)
+		{
+			if (sectionLine == lines.size())
+			{
+				if (!lines.empty() && !trim(lines.back()).empty())
+				{
+					lines.emplace_back();
+				}
+
+				lines.push_back(fmt::format("[{}]", change.section));
+				insertAt = lines.size();
+			}
+
+			lines.insert(lines.begin() + insertAt, std::move(line));
+		}
+	}
+
+	// write everything next to the file and swap it in, so a crash never leaves half an ini. The copy
+	// is named after our process so it can't be mixed up with another client's.
+	const std::string tempPath = fmt::format("{}.{}.tmp", m_path, GetCurrentProcessId());
+	{
+		std::ofstream file(tempPath, std::ios::trunc);
+		for (const std::string& line : lines)
+		{
+			file << line << '\n';
+		}
+
+		file.flush();
+		if (!file)
+			return false;
+	}
+
+	if (!MoveFileExA(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		DeleteFileA(tempPath.c_str());
+		return false;
+	}
+
+	m_writes.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+} // namespace remote
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "NameHash.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace remote {
+
+// MQRemote.ini held in memory. Reads never touch the disk. Changes are applied to memory at once
+// and queued for a background thread, which waits a moment so a burst of changes is written
+// together. A write reads the file again, merges in only the queued changes so edits made by
+// other clients sharing the file survive, and replaces the file with a complete temporary copy.
+// Clients take a named mutex around all of that, so two writes never interleave.
+class Settings
+{
+public:
+	explicit Settings(std::string path) : m_path(std::move(path)) {}
+	~Settings() { Stop(); }
+
+	// Reads the whole file into memory, replacing what was loaded before
+	void Load();
+
+	void Start();
+
+	// Writes any queued changes on the calling thread before returning
+	void Stop();
+
+	std::string GetString(std::string_view section, std::string_view key, std::string_view defaultValue = {}) const;
+	int GetInt(std::string_view section, std::string_view key, int defaultValue) const;
+	bool GetBool(std::string_view section, std::string_view key, bool defaultValue) const;
+	bool HasKey(std::string_view section, std::string_view key) const;
+
+	// Keys of a section in file order
+	std::vector<std::string> GetKeys(std::string_view section) const;
+
+	void SetString(std::string_view section, std::string_view key, std::string_view value);
+	void SetInt(std::string_view section, std::string_view key, int value);
+	void SetBool(std::string_view section, std::string_view key, bool value);
+	void DeleteKey(std::string_view section, std::string_view key);
+
+	uint64_t GetWrites() const { return m_writes.load(std::memory_order_relaxed); }
+	uint64_t GetChanges() const { return m_changes; }
+
+private:
+	using Entries = std::vector<std::pair<std::string, std::string>>;
+
+	struct Change
+	{
+		std::string section;
+		std::string key;
+		std::optional<std::string> value; // empty to delete the key
+	};
+
+	const std::string* Find(std::string_view section, std::string_view key) const;
+	void Queue(std::string_view section, std::string_view key, std::optional<std::string> value);
+	void Run();
+	bool Write(const std::vector<Change>& changes);
+	bool MergeAndReplace(const std::vector<Change>& changes);
+
+	std::string m_path;
+	std::unordered_map<std::string, Entries, NameHash, NameEqual> m_sections; // game thread only
+	uint64_t m_changes = 0;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::vector<Change> m_pending; // guarded by m_mutex
+	bool m_stopping = false;       // guarded by m_mutex
+	std::thread m_writer;
+	std::atomic<uint64_t> m_writes{ 0 };
+};
+
+} // namespace remote
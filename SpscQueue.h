@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+
+namespace remote {
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. The capacity
+// is rounded up to a power of two.
+template <typename T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+
+		m_mask = size - 1;
+		m_slots = std::make_unique<std::optional<T>[]>(size);
+	}
+
+	// Producer only, returns false if the queue is full
+	bool TryPush(T&& value)
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_cachedHead > m_mask)
+		{
+			m_cachedHead = m_head.load(std::memory_order_acquire);
+			if (tail - m_cachedHead > m_mask)
+				return false;
+		}
+
+		m_slots[tail & m_mask].emplace(std::move(value));
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer only, returns false if the queue is empty
+	bool TryPop(T& value)
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_cachedTail)
+		{
+			m_cachedTail = m_tail.load(std::memory_order_acquire);
+			if (head == m_cachedTail)
+				return false;
+		}
+
+		std::optional<T>& slot = m_slots[head & m_mask];
+		value = std::move(*slot);
+		slot.reset();
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Either side, only a snapshot while the other side is running
+	size_t GetSize() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+	size_t GetCapacity() const { return m_mask + 1; }
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+private:
+	static constexpr size_t CACHE_LINE = 64;
+
+	std::unique_ptr<std::optional<T>[]> m_slots;
+	size_t m_mask = 0;
+
+	// each side keeps the other's index cached so it only touches the shared line when it must
+	alignas(CACHE_LINE) std::atomic<size_t> m_head{ 0 };
+	size_t m_cachedTail = 0;
+	alignas(CACHE_LINE) std::atomic<size_t> m_tail{ 0 };
+	size_t m_cachedHead = 0;
+};
+
+} // namespace remote
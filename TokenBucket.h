@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace remote {
+
+// Commands are sent and run in one of two lanes. Urgent commands skip batching and are run
+// before any queued bulk command.
+enum class Lane : uint8_t
+{
+	Urgent,
+	Bulk,
+};
+
+constexpr size_t LANE_COUNT = 2;
+
+// Commands per second with bursts of up to burst commands, a rate of 0 is unlimited
+struct RateLimit
+{
+	double rate = 0;
+	double burst = 0;
+};
+
+class TokenBucket
+{
+public:
+	// Takes count tokens if there are enough, a bucket starts out full
+	bool TryTake(const RateLimit& limit, std::chrono::steady_clock::time_point now, double count = 1)
+	{
+		if (limit.rate <= 0)
+			return true;
+
+		const double burst = std::max(limit.burst, 1.0);
+		m_tokens = m_started
+			? std::min(burst, m_tokens + std::chrono::duration<double>(now - m_lastRefill).count() * limit.rate)
+			: burst;
+		m_lastRefill = now;
+		m_started = true;
+
+		// a batch larger than the burst goes through once the bucket is full
+		if (m_tokens < std::min(count, burst))
+			return false;
+
+		m_tokens -= count;
+		return true;
+	}
+
+private:
+	double m_tokens = 0;
+	std::chrono::steady_clock::time_point m_lastRefill;
+	bool m_started = false;
+};
+
+// Per lane limits, see Channel::SendCommand and Channel::HandleMessage
+struct LaneOptions
+{
+	std::array<RateLimit, LANE_COUNT> send;    // commands sent per channel
+	std::array<RateLimit, LANE_COUNT> receive; // commands accepted per sender on a channel
+	size_t sendBacklog = 256;                  // sends held back per channel and lane before new ones are dropped
+};
+
+struct LaneStats
+{
+	uint64_t sent = 0;
+	uint64_t throttled = 0; // held back by the send limit
+	uint64_t dropped = 0;   // over the send backlog
+	uint64_t refused = 0;   // received over a sender's receive limit
+};
+
+} // namespace remote
@@ -0,0 +1,160 @@
+#include "TopicTrie.h"
+
+#include <mq/Plugin.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace remote {
+
+static constexpr std::string_view WILDCARD = "*";
+
+// Splits off the first segment of a dotted name, leaving the rest in name
+static std::string_view NextSegment(std::string_view& name)
+{
+	const size_t dot = name.find('.');
+	std::string_view segment = name.substr(0, dot);
+	name = dot == std::string_view::npos ? std::string_view() : name.substr(dot + 1);
+	return segment;
+}
+
+bool TopicTrie::IsValid(std::string_view pattern)
+{
+	if (pattern.empty() || pattern.front() == '.' || pattern.back() == '.')
+		return false;
+
+	while (!pattern.empty())
+	{
+		std::string_view segment = NextSegment(pattern);
+		if (segment.empty())
+			return false;
+
+		// a * stands for a whole segment, not part of one
+		if (segment != WILDCARD && segment.find('*') != std::string_view::npos)
+			return false;
+	}
+
+	return true;
+}
+
+bool TopicTrie::Add(std::string_view pattern)
+{
+	if (!IsValid(pattern))
+		return false;
+
+	Node* node = &m_root;
+	for (std::string_view rest = pattern; !rest.empty();)
+	{
+		std::string_view segment = NextSegment(rest);
+		if (segment == WILDCARD)
+		{
+			if (!node->wildcard)
+			{
+				node->wildcard = std::make_unique<Node>();
+			}
+			node = node->wildcard.get();
+		}
+		else
+		{
+			std::unique_ptr<Node>& child = node->children[std::string(segment)];
+			if (!child)
+			{
+				child = std::make_unique<Node>();
+			}
+			node = child.get();
+		}
+	}
+
+	if (node->subscribed)
+		return false;
+
+	node->subscribed = true;
+	m_patterns.push_back(mq::to_lower_copy(pattern));
+	return true;
+}
+
+bool TopicTrie::Remove(Node& node, std::string_view pattern, bool& removed)
+{
+	if (pattern.empty())
+	{
+		removed = std::exchange(node.subscribed, false);
+		return node.IsLeaf();
+	}
+
+	std::string_view segment = NextSegment(pattern);
+	if (segment == WILDCARD)
+	{
+		if (node.wildcard && Remove(*node.wildcard, pattern, removed))
+		{
+			node.wildcard.reset();
+		}
+	}
+	else if (auto it = node.children.find(segment); it != node.children.end())
+	{
+		if (Remove(*it->second, pattern, removed))
+		{
+			node.children.erase(it);
+		}
+	}
+
+	// branches left without subscriptions are pruned on the way back up
+	return node.IsLeaf();
+}
+
+bool TopicTrie::Remove(std::string_view pattern)
+{
+	bool removed = false;
+	if (IsValid(pattern))
+	{
+		Remove(m_root, pattern, removed);
+	}
+
+	if (removed)
+	{
+		m_patterns.erase(std::find_if(m_patterns.begin(), m_patterns.end(),
+			[&](const std::string& existing) { return ci_equals(existing, pattern); }));
+	}
+
+	return removed;
+}
+
+void TopicTrie::Clear()
+{
+	m_root = Node();
+	m_patterns.clear();
+}
+
+bool TopicTrie::Match(const Node& node, std::string_view topic)
+{
+	if (topic.empty())
+		return node.subscribed;
+
+	std::string_view segment = NextSegment(topic);
+	if (auto it = node.children.find(segment); it != node.children.end() && Match(*it->second, topic))
+		return true;
+
+	if (node.wildcard)
+	{
+		// a trailing * takes every segment that is left
+		if (node.wildcard->subscribed)
+			return true;
+
+		if (Match(*node.wildcard, topic))
+			return true;
+	}
+
+	return false;
+}
+
+bool TopicTrie::Matches(std::string_view topic) const
+{
+	return !topic.empty() && !m_patterns.empty() && Match(m_root, topic);
+}
+
+bool TopicTrie::Contains(std::string_view pattern) const
+{
+	return std::any_of(m_patterns.begin(), m_patterns.end(),
+		[&](const std::string& existing) { return ci_equals(existing, pattern); });
+}
+
+} // namespace remote
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "NameHash.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace remote {
+
+// Topics are dotted names such as raid2.casters.clr. Any channel name with a dot or a * is a topic.
+inline bool IsTopicName(std::string_view name)
+{
+	return name.find_first_of(".*") != std::string_view::npos;
+}
+
+// Topic subscriptions, one level of the trie per dotted segment. A * segment matches any one
+// segment, and a * at the end of a pattern matches one or more, so raid2.* matches raid2.clr and
+// raid2.casters.clr while *.clr only matches two level topics. A topic is matched by walking its
+// segments, so the cost depends on its depth and not on the number of subscriptions.
+class TopicTrie
+{
+public:
+	// False if the pattern is empty, has an empty segment or is already subscribed
+	bool Add(std::string_view pattern);
+	bool Remove(std::string_view pattern);
+	void Clear();
+
+	bool Matches(std::string_view topic) const;
+	bool Contains(std::string_view pattern) const;
+
+	bool IsEmpty() const { return m_patterns.empty(); }
+	const std::vector<std::string>& GetPatterns() const { return m_patterns; }
+
+	// Checks a pattern's syntax without subscribing to it
+	static bool IsValid(std::string_view pattern);
+
+private:
+	struct Node
+	{
+		std::unordered_map<std::string, std::unique_ptr<Node>, NameHash, NameEqual> children;
+		std::unique_ptr<Node> wildcard;
+		bool subscribed = false;
+
+		bool IsLeaf() const { return !subscribed && !wildcard && children.empty(); }
+	};
+
+	static bool Match(const Node& node, std::string_view topic);
+	static bool Remove(Node& node, std::string_view pattern, bool& removed);
+
+	Node m_root;
+	std::vector<std::string> m_patterns; // in the order they were added, lowercased
+};
+
+} // namespace remote
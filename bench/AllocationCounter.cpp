@@ -0,0 +1,48 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Only ever linked into the benchmark executable
+static std::atomic<bool> s_countAllocations{ false };
+static std::atomic<uint64_t> s_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+	if (s_countAllocations.load(std::memory_order_relaxed))
+	{
+		s_allocations.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+namespace remote {
+
+void StartCountingAllocations()
+{
+	s_allocations = 0;
+	s_countAllocations = true;
+}
+
+uint64_t StopCountingAllocations()
+{
+	s_countAllocations = false;
+	return s_allocations.load();
+}
+
+} // namespace remote
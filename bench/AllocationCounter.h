@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+namespace remote {
+
+// Counts calls to the global operator new, which AllocationCounter.cpp replaces. The replacement
+// new and delete live in their own translation unit so the compiler sees them as a matched pair.
+void StartCountingAllocations();
+uint64_t StopCountingAllocations(); // returns the allocations since the last start
+
+} // namespace remote
@@ -0,0 +1,298 @@
+// Standalone benchmarks for the parser, codec, receive and routing hot paths, built against the
+// stand-ins in bench/mq. Prints one JSON object per benchmark so results can be compared between
+// versions, see bench/CMakeLists.txt.
+
+#include "AllocationCounter.h"
+#include "CommandArgs.h"
+#include "CommandDictionary.h"
+#include "NameHash.h"
+#include "ReceivePipeline.h"
+#include "ReferenceCommandArgs.h"
+
+#include "mq/Plugin.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unordered_map>
+
+namespace remote {
+
+static constexpr uint64_t BENCHMARK_ITERATIONS = 20000;
+
+// A mix of the traffic seen from alias heavy setups
+static constexpr const char* COMMAND_LINES[] = {
+	"group /stand",
+	"+self group /sit",
+	"group /target id 1234",
+	"+self raid /cast 3",
+	"server Alice /macro kissassist assist",
+	"server Bob /stick 10 behind moveback",
+	"zone /keypress forward hold",
+	"global /noparse /echo ${Me.PctHPs} ${Me.PctMana}",
+	"clerics /multiline ; /target id 5678 ; /cast \"Complete Heal\"",
+	"raid Carol /useitem \"Staff of Temperate Flux\"",
+	"+self server /docommand /timed 5 /afollow on",
+	"custom_channel /say I am a cleric",
+	"!group /stand",
+	"group ~target /target id 1234",
+	"+self server Alice ~ /stick 10 behind",
+	"@+250ms raid /cast 3",
+	"+self @+1s group /stand",
+};
+
+static constexpr std::string_view CHANNEL_NAMES[] = {
+	"global", "server", "group", "raid", "zone", "clerics", "casters", "unknown",
+};
+
+struct BenchmarkResult
+{
+	std::string_view name;
+	uint64_t iterations = 0;
+	double nsPerOp = 0;
+	double allocsPerOp = 0;
+	double opsPerSec = 0;
+};
+
+// keeps the optimizer from discarding the work being measured
+static volatile size_t s_sink = 0;
+
+template <typename Func>
+static BenchmarkResult Measure(std::string_view name, Func&& func)
+{
+	for (uint64_t i = 0; i < BENCHMARK_ITERATIONS / 10; ++i)
+	{
+		s_sink = s_sink + func(i);
+	}
+
+	StartCountingAllocations();
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint64_t i = 0; i < BENCHMARK_ITERATIONS; ++i)
+	{
+		s_sink = s_sink + func(i);
+	}
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	const uint64_t allocations = StopCountingAllocations();
+
+	BenchmarkResult result;
+	result.name = name;
+	result.iterations = BENCHMARK_ITERATIONS;
+	result.nsPerOp = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / BENCHMARK_ITERATIONS;
+	result.allocsPerOp = static_cast<double>(allocations) / BENCHMARK_ITERATIONS;
+	result.opsPerSec = result.nsPerOp > 0 ? 1e9 / result.nsPerOp : 0;
+	return result;
+}
+
+static std::string EncodeBroadcast(const std::string& command, bool includeSelf)
+{
+	proto::remote::Message message;
+	message.set_id(proto::remote::MessageId::Broadcast);
+	message.set_command(command);
+	message.set_includeself(includeSelf);
+	return message.SerializeAsString();
+}
+
+// A dictionary encoded batch of count commands, as received under load
+static std::string EncodeCompressedBatch(const std::vector<std::string>& commands, size_t first, size_t count)
+{
+	proto::remote::Message message;
+	message.set_id(proto::remote::MessageId::Broadcast);
+	message.set_dictionary(COMMAND_DICTIONARY_VERSION);
+	for (size_t n = 0; n < count; ++n)
+	{
+		std::string_view command = commands[(first + n) % commands.size()];
+		const uint32_t prefix = FindCommandPrefix(command);
+		message.add_prefixes(prefix);
+		message.add_commands(std::string(command.substr(GetCommandPrefix(prefix).size())));
+	}
+	return message.SerializeAsString();
+}
+
+// Reads just the id and includeself fields from an encoded message, the cost of a message that is
+// dropped without a full parse
+static bool PeekMessageHeader(const std::string& payload, proto::remote::MessageId& id, bool& includeSelf)
+{
+	using google::protobuf::internal::WireFormatLite;
+
+	google::protobuf::io::CodedInputStream stream(
+		reinterpret_cast<const uint8_t*>(payload.data()), static_cast<int>(payload.size()));
+
+	id = proto::remote::MessageId::NoOp;
+	includeSelf = false;
+
+	while (uint32_t tag = stream.ReadTag())
+	{
+		switch (WireFormatLite::GetTagFieldNumber(tag))
+		{
+		case proto::remote::Message::kIdFieldNumber:
+			{
+				uint32_t value = 0;
+				if (!stream.ReadVarint32(&value))
+					return false;
+				id = static_cast<proto::remote::MessageId>(value);
+			}
+			break;
+
+		case proto::remote::Message::kIncludeselfFieldNumber:
+			{
+				uint32_t value = 0;
+				if (!stream.ReadVarint32(&value))
+					return false;
+				includeSelf = value != 0;
+			}
+			break;
+
+		default:
+			if (!WireFormatLite::SkipField(&stream, tag))
+				return false;
+			break;
+		}
+	}
+
+	return true;
+}
+
+static void RunBenchmarks(std::string_view filter)
+{
+	constexpr size_t lineCount = std::size(COMMAND_LINES);
+
+	std::vector<std::string> commands;
+	std::vector<std::string> payloads;
+	for (const char* line : COMMAND_LINES)
+	{
+		std::optional<RemoteCommandArgs> args = GetRemoteCommandArgs(line);
+		commands.push_back(args ? unescape_args(args->message) : std::string(line));
+		payloads.push_back(EncodeBroadcast(commands.back(), args && args->includeSelf));
+	}
+
+	std::vector<BenchmarkResult> results;
+	auto run = [&](std::string_view name, auto&& func) {
+		if (filter.empty() || name.find(filter) != std::string_view::npos)
+		{
+			results.push_back(Measure(name, func));
+		}
+	};
+
+	run("parse.tokenize_args", [&](uint64_t i) {
+		return tokenize_args(COMMAND_LINES[i % lineCount]).size();
+	});
+
+	run("parse.unescape_args", [&](uint64_t i) {
+		return unescape_args(COMMAND_LINES[i % lineCount]).size();
+	});
+
+	run("parse.rc_args", [&](uint64_t i) -> size_t {
+		std::optional<RemoteCommandArgs> args = GetRemoteCommandArgs(COMMAND_LINES[i % lineCount]);
+		return args ? unescape_args(args->message).size() : 0;
+	});
+
+	run("parse.rc_args_reference", [&](uint64_t i) -> size_t {
+		std::optional<ReferenceCommandArgs> args = GetReferenceCommandArgs(COMMAND_LINES[i % lineCount]);
+		return args ? unescape_args(args->message).size() : 0;
+	});
+
+	run("codec.encode", [&](uint64_t i) {
+		proto::remote::Message message;
+		message.set_id(proto::remote::MessageId::Broadcast);
+		message.set_command(commands[i % lineCount]);
+		message.set_includeself(false);
+		return message.SerializeAsString().size();
+	});
+
+	run("codec.encode_batch3", [&](uint64_t i) {
+		proto::remote::Message message;
+		message.set_id(proto::remote::MessageId::Broadcast);
+		for (uint64_t n = 0; n < 3; ++n)
+		{
+			message.add_commands(commands[(i + n) % lineCount]);
+		}
+		return message.SerializeAsString().size();
+	});
+
+	run("codec.decode_fresh", [&](uint64_t i) {
+		proto::remote::Message message;
+		message.ParseFromString(payloads[i % lineCount]);
+		return message.command().size();
+	});
+
+	proto::remote::Message reused;
+	run("codec.decode_reused", [&](uint64_t i) {
+		reused.Clear();
+		reused.ParseFromString(payloads[i % lineCount]);
+		return reused.command().size();
+	});
+
+	run("codec.peek_header", [&](uint64_t i) -> size_t {
+		proto::remote::MessageId id;
+		bool includeSelf;
+		return PeekMessageHeader(payloads[i % lineCount], id, includeSelf) && includeSelf;
+	});
+
+	// Game thread time per received batch, decoding it right there or handing it to the decode thread.
+	// Allocations include the ones made by the decode thread.
+	std::vector<std::shared_ptr<postoffice::Message>> received;
+	for (size_t i = 0; i < lineCount; ++i)
+	{
+		auto message = std::make_shared<postoffice::Message>();
+		message->Payload.reset(new std::string(EncodeCompressedBatch(commands, i, 8)));
+		received.push_back(std::move(message));
+	}
+
+	run("receive.inline", [&](uint64_t i) {
+		ReceivedMessage message;
+		message.message = received[i % lineCount];
+		ReceivePipeline::Decode(message);
+		return static_cast<size_t>(message.decoded.commands_size());
+	});
+
+	ReceivePipeline pipeline;
+	pipeline.Start(4096);
+	const std::weak_ptr<Channel*> noChannel;
+	run("receive.pipeline", [&](uint64_t i) {
+		pipeline.Submit(noChannel, received[i % lineCount]);
+		return pipeline.Drain([](ReceivedMessage& message) { s_sink = s_sink + message.decoded.commands_size(); });
+	});
+	pipeline.Stop();
+
+	// the interned name lookup behind ChannelManager::FindChannel
+	std::unordered_map<std::string, uint16_t, NameHash, NameEqual> handles;
+	for (std::string_view name : CHANNEL_NAMES)
+	{
+		if (name != "unknown")
+		{
+			handles.emplace(name, static_cast<uint16_t>(handles.size()));
+		}
+	}
+
+	run("route.find_channel", [&](uint64_t i) -> size_t {
+		return handles.find(CHANNEL_NAMES[i % std::size(CHANNEL_NAMES)]) != handles.end();
+	});
+
+	const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	for (const BenchmarkResult& result : results)
+	{
+		fmt::print(R"({{"time":{},"bench":"{}","iterations":{},"ns_per_op":{:.1f},"allocs_per_op":{:.2f},"ops_per_sec":{:.0f}}})" "\n",
+			timestamp, result.name, result.iterations, result.nsPerOp, result.allocsPerOp, result.opsPerSec);
+	}
+
+	if (filter.empty() || std::string_view("parse.verify").find(filter) != std::string_view::npos)
+	{
+		fmt::print(R"({{"time":{},"bench":"parse.verify","mismatches":{}}})" "\n", timestamp, CountParserMismatches(COMMAND_LINES));
+	}
+}
+
+} // namespace remote
+
+int main(int argc, char* argv[])
+{
+	remote::RunBenchmarks(argc > 1 ? argv[1] : "");
+	return 0;
+}
@@ -0,0 +1,128 @@
+// Checks the /rc argument parser against known lines and against the tokenize_args based parser
+// it replaced. Exits non-zero on any failure, see bench/CMakeLists.txt.
+
+#include "CommandArgs.h"
+#include "ReferenceCommandArgs.h"
+
+#include "mq/Plugin.h"
+
+#include <string>
+
+using namespace remote;
+
+static int s_failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { ++s_failures; fmt::print(stderr, "{}:{}: CHECK({}) failed\n", __FILE__, __LINE__, #condition); } } while (false)
+
+static const std::string LONGEST_CHANNEL(RemoteCommandArgs::MAX_CHANNEL_LENGTH, 'C');
+static const std::string TOO_LONG_CHANNEL(RemoteCommandArgs::MAX_CHANNEL_LENGTH + 1, 'C');
+
+static void TestFields()
+{
+	std::optional<RemoteCommandArgs> args = GetRemoteCommandArgs("+self @+2s !Raid Bob,,Carol ~buff /cast \"Complete Heal\"");
+	CHECK(args.has_value());
+	if (!args)
+		return;
+
+	CHECK(args->includeSelf);
+	CHECK(args->scheduled);
+	CHECK(args->delay == std::chrono::milliseconds(2000));
+	CHECK(args->urgent);
+	CHECK(args->channelArg == "Raid");
+	CHECK(args->GetChannel() == "raid");
+	CHECK(args->receiver == "Bob,,Carol");
+	CHECK(args->receiverCount == 2);
+	CHECK(args->coalesce);
+	CHECK(args->key == "buff");
+	CHECK(args->message == "/cast \"Complete Heal\"");
+
+	args = GetRemoteCommandArgs("group /stand");
+	CHECK(args && !args->includeSelf && !args->scheduled && !args->urgent && args->receiver.empty() && !args->coalesce);
+	CHECK(args && args->GetChannel() == "group" && args->message == "/stand");
+
+	// a bare ~ coalesces on the message itself
+	args = GetRemoteCommandArgs("group ~ /stand");
+	CHECK(args && args->coalesce && args->key.empty());
+}
+
+static void TestRejected()
+{
+	CHECK(!GetRemoteCommandArgs(nullptr));
+	CHECK(!GetRemoteCommandArgs(""));
+	CHECK(!GetRemoteCommandArgs("group"));
+	CHECK(!GetRemoteCommandArgs("group Bob"));
+	CHECK(!GetRemoteCommandArgs("+self /stand"));
+	CHECK(!GetRemoteCommandArgs("@+61s group /stand"));
+	CHECK(!GetRemoteCommandArgs("@+5m group /stand"));
+	CHECK(!GetRemoteCommandArgs("@+soon group /stand"));
+}
+
+static void TestChannelLength()
+{
+	std::string line = LONGEST_CHANNEL + " /stand";
+	std::optional<RemoteCommandArgs> args = GetRemoteCommandArgs(line.c_str());
+	CHECK(args && args->GetChannel() == mq::to_lower_copy(LONGEST_CHANNEL));
+
+	// too long to be a channel, the argument is still there for sending to characters
+	line = TOO_LONG_CHANNEL + " /stand";
+	args = GetRemoteCommandArgs(line.c_str());
+	CHECK(args && args->GetChannel().empty() && args->channelArg == TOO_LONG_CHANNEL);
+}
+
+static void TestParseDelay()
+{
+	CHECK(ParseDelay("250") == std::chrono::milliseconds(250));
+	CHECK(ParseDelay("250ms") == std::chrono::milliseconds(250));
+	CHECK(ParseDelay("2s") == std::chrono::milliseconds(2000));
+	CHECK(ParseDelay("60s") == MAX_SCHEDULE_DELAY);
+	CHECK(!ParseDelay("61s"));
+	CHECK(!ParseDelay("99999999999999999999"));
+	CHECK(!ParseDelay("s"));
+	CHECK(!ParseDelay("10m"));
+}
+
+static void TestAgainstReference()
+{
+	const std::string lines[] = {
+		"group /stand",
+		"+self group /sit",
+		"group /target id 1234",
+		"server Alice /macro kissassist assist",
+		"server Alice,Bob /stick 10 behind moveback",
+		"global /noparse /echo ${Me.PctHPs} ${Me.PctMana}",
+		"clerics /multiline ; /target id 5678 ; /cast \"Complete Heal\"",
+		"raid Carol /useitem \"Staff of Temperate Flux\"",
+		"\"my channel\" /say quoted",
+		"!group /stand",
+		"! /stand",
+		"group ~target /target id 1234",
+		"+self server Alice ~ /stick 10 behind",
+		"@+250ms raid /cast 3",
+		"+self @+1s !Group /stand",
+		"\tgroup\t/stand\t",
+		LONGEST_CHANNEL + " /stand",
+		TOO_LONG_CHANNEL + " /stand",
+		"+self !" + TOO_LONG_CHANNEL + " Bob /stand",
+	};
+
+	CHECK(CountParserMismatches(lines) == 0);
+}
+
+int main()
+{
+	TestFields();
+	TestRejected();
+	TestChannelLength();
+	TestParseDelay();
+	TestAgainstReference();
+
+	if (s_failures)
+	{
+		fmt::print(stderr, "{} check(s) failed\n", s_failures);
+		return 1;
+	}
+
+	fmt::print("All checks passed\n");
+	return 0;
+}
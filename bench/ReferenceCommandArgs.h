@@ -0,0 +1,158 @@
+#pragma once
+
+#include "CommandArgs.h"
+
+#include "mq/Plugin.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace remote {
+
+// The tokenize_args based parser that GetRemoteCommandArgs replaced, kept to check that the
+// single pass parser still agrees with it.
+struct ReferenceCommandArgs
+{
+	bool includeSelf = false;
+	std::optional<std::chrono::milliseconds> delay;
+	bool urgent = false;
+	std::string channel;
+	std::optional<std::string> key;
+	std::optional<std::string> receiver;
+	std::string message;
+};
+
+inline std::optional<ReferenceCommandArgs> GetReferenceCommandArgs(const char* szLine)
+{
+	if (!szLine || !*szLine)
+	{
+		return std::nullopt;
+	}
+
+	ReferenceCommandArgs result{};
+	std::string_view line(szLine);
+	std::vector<std::string_view> args = tokenize_args(line);
+	size_t i = 0;
+
+	if (i < args.size() && args[i] == "+self")
+	{
+		result.includeSelf = true;
+		++i;
+	}
+
+	if (i < args.size() && args[i].size() > 2 && args[i].substr(0, 2) == "@+")
+	{
+		result.delay = ParseDelay(args[i].substr(2));
+		if (!result.delay)
+		{
+			return std::nullopt;
+		}
+		++i;
+	}
+
+	if (i + 1 >= args.size())
+	{
+		return std::nullopt;
+	}
+
+	std::string_view channel = args[i];
+	if (channel.size() > 1 && channel[0] == '!')
+	{
+		result.urgent = true;
+		channel.remove_prefix(1);
+	}
+
+	result.channel = mq::to_lower_copy(channel);
+	++i;
+
+	if (i < args.size() && !args[i].empty() && args[i][0] != '/' && args[i][0] != '~')
+	{
+		result.receiver = std::string(args[i]);
+		++i;
+	}
+
+	if (i < args.size() && !args[i].empty() && args[i][0] == '~')
+	{
+		result.key = std::string(args[i].substr(1));
+		++i;
+	}
+
+	if (i >= args.size() || args[i].empty() || args[i][0] != '/')
+	{
+		return std::nullopt;
+	}
+
+	result.message = std::string(line.substr(args[i].data() - line.data()));
+
+	return result;
+}
+
+// GetRemoteCommandArgs only lowercases channels short enough for its buffer, longer ones must
+// leave GetChannel() empty
+inline bool ParsersAgree(const char* szLine)
+{
+	std::optional<RemoteCommandArgs> args = GetRemoteCommandArgs(szLine);
+	std::optional<ReferenceCommandArgs> reference = GetReferenceCommandArgs(szLine);
+
+	if (!args || !reference)
+		return !args && !reference;
+
+	const std::string_view channel = reference->channel.size() <= RemoteCommandArgs::MAX_CHANNEL_LENGTH
+		? std::string_view(reference->channel) : std::string_view();
+
+	return args->includeSelf == reference->includeSelf
+		&& args->scheduled == reference->delay.has_value()
+		&& args->delay == reference->delay.value_or(std::chrono::milliseconds(0))
+		&& args->urgent == reference->urgent
+		&& args->GetChannel() == channel
+		&& mq::to_lower_copy(args->channelArg) == reference->channel
+		&& args->receiver == reference->receiver.value_or(std::string())
+		&& args->coalesce == reference->key.has_value()
+		&& args->key == reference->key.value_or(std::string())
+		&& args->message == reference->message;
+}
+
+// Runs the lines and random mutations of them through both parsers, returns the number of mismatches
+template <typename Lines>
+int CountParserMismatches(const Lines& lines)
+{
+	static constexpr char MUTATIONS[] = { ' ', '\t', '"', '/', '+', 'A', 'z', ';', '\\' };
+
+	int mismatches = 0;
+	uint32_t seed = 0x12345678;
+	auto next_random = [&seed]() { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+
+	for (const auto& line : lines)
+	{
+		const std::string original(line);
+		if (!ParsersAgree(original.c_str()))
+			++mismatches;
+
+		for (int n = 0; n < 200; ++n)
+		{
+			std::string mutated = original;
+			for (uint32_t edits = next_random() % 4 + 1; edits > 0; --edits)
+			{
+				size_t at = next_random() % (mutated.size() + 1);
+				switch (next_random() % 3)
+				{
+				case 0: mutated.insert(mutated.begin() + at, MUTATIONS[next_random() % std::size(MUTATIONS)]); break;
+				case 1: if (at < mutated.size()) mutated.erase(at, 1); break;
+				case 2: mutated.resize(at); break;
+				}
+			}
+
+			if (!ParsersAgree(mutated.c_str()))
+				++mismatches;
+		}
+	}
+
+	return mismatches;
+}
+
+} // namespace remote
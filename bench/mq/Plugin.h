@@ -0,0 +1,155 @@
+#pragma once
+
+// Stand-ins for the parts of the MacroQuest plugin API used by the sources the benchmarks build,
+// so they can be compiled and timed outside of the game. Commands and chat go nowhere and the
+// postoffice never delivers anything.
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+using DWORD = uint32_t;
+
+inline DWORD GetCurrentProcessId()
+{
+	return static_cast<DWORD>(getpid());
+}
+
+namespace mq {
+
+inline std::string to_lower_copy(std::string_view text)
+{
+	std::string result(text);
+	std::transform(result.begin(), result.end(), result.begin(),
+		[](char ch) { return static_cast<char>(std::tolower(static_cast<unsigned char>(ch))); });
+	return result;
+}
+
+inline bool ci_equals(std::string_view a, std::string_view b)
+{
+	return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+		return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+	});
+}
+
+inline std::string_view trim(std::string_view text)
+{
+	const size_t first = text.find_first_not_of(" \t\r\n");
+	if (first == std::string_view::npos)
+		return {};
+
+	return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+// Whitespace separated arguments, a quoted argument runs up to its closing quote
+inline std::vector<std::string_view> tokenize_args(std::string_view line)
+{
+	std::vector<std::string_view> args;
+	size_t pos = 0;
+	while (true)
+	{
+		while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t'))
+			++pos;
+
+		if (pos >= line.size())
+			return args;
+
+		if (line[pos] == '"')
+		{
+			const size_t start = ++pos;
+			const size_t end = std::min(line.find('"', start), line.size());
+			args.push_back(line.substr(start, end - start));
+			pos = std::min(end + 1, line.size());
+			continue;
+		}
+
+		const size_t start = pos;
+		while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t')
+			++pos;
+
+		args.push_back(line.substr(start, pos - start));
+	}
+}
+
+// Drops the backslash from escaped characters
+inline std::string unescape_args(std::string_view line)
+{
+	std::string result;
+	result.reserve(line.size());
+	for (size_t i = 0; i < line.size(); ++i)
+	{
+		if (line[i] == '\\' && i + 1 < line.size())
+			++i;
+
+		result.push_back(line[i]);
+	}
+
+	return result;
+}
+
+} // namespace mq
+
+using namespace mq;
+
+inline void DoCommand(const char*, bool = true) {}
+inline void WriteChatf(const char*, ...) {}
+
+namespace postoffice {
+
+struct Address
+{
+	std::optional<std::string> Name;
+	std::optional<std::string> Mailbox;
+	std::optional<std::string> Account;
+	std::optional<std::string> Server;
+	std::optional<std::string> Character;
+	std::optional<uint32_t> PID;
+};
+
+struct Message
+{
+	std::optional<Address> Sender;
+	std::shared_ptr<std::string> Payload;
+};
+
+using ResponseCallbackAPI = std::function<void(int, const std::shared_ptr<Message>&)>;
+using ReceiveCallbackAPI = std::function<void(const std::shared_ptr<Message>&)>;
+
+class DropboxAPI
+{
+public:
+	template <typename T>
+	void Post(const Address& address, const T& obj, const ResponseCallbackAPI& callback = nullptr)
+	{
+		Post(address, obj.SerializeAsString(), callback);
+	}
+
+	void Post(const Address&, const std::string&, const ResponseCallbackAPI& = nullptr) {}
+
+	template <typename T>
+	void PostReply(const std::shared_ptr<Message>& message, const T& obj, uint8_t status = 0)
+	{
+		PostReply(message, obj.SerializeAsString(), status);
+	}
+
+	void PostReply(const std::shared_ptr<Message>&, const std::string&, uint8_t = 0) {}
+	void Remove() {}
+	bool IsValid() const { return true; }
+};
+
+inline DropboxAPI AddActor(const char*, ReceiveCallbackAPI&&)
+{
+	return DropboxAPI();
+}
+
+} // namespace postoffice